@@ -4,5 +4,6 @@
 #include "tetmesh/volume.h"
 #include "tetmesh/surface.h"
 #include "tetmesh/farfield.h"
+#include "tetmesh/offset.h"
 
 #endif
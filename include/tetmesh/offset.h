@@ -0,0 +1,105 @@
+#ifndef OFFSET_H_3A9D6E21_8C4B_4F07_B5E2_71D0C8F94A63
+#define OFFSET_H_3A9D6E21_8C4B_4F07_B5E2_71D0C8F94A63
+
+#include <string>
+#include <vector>
+
+#include "unstruc/grid.h"
+
+namespace tetmesh {
+
+	// Settings for one offset run. Nothing is kept between runs, so runs with
+	// different settings can share a surface and go at the same time
+	struct OffsetOptions {
+		double offset_size; // Size of the first layer. No layers if 0
+		size_t n_layers;
+		double growth_rate;
+
+		// Intermediate files are named from intermediate_filename
+		bool write_intermediate;
+		std::string intermediate_filename;
+
+		// Edge weighting
+		bool use_tangents;
+		bool use_length;
+		bool use_inverse_length;
+		bool use_sqrt_length;
+		bool use_angle;
+		bool use_inverse_angle;
+		bool use_sqrt_angle;
+
+		bool use_original_offset;
+		bool use_offset_skew_fix;
+		bool use_future_intersections;
+		bool use_global_repair;
+
+		// Repair smoothing stops following points that move less than this
+		// fraction of the offset size in a pass
+		double repair_tolerance;
+
+		double max_lambda;
+		double max_normals_skew_angle;
+
+		bool use_skew_restriction;
+		double max_skew_angle;
+		double max_relaxed_skew_angle;
+
+		double tetgen_min_ratio;
+
+		// Smoothing stops early once no point moves by more than this fraction
+		// of the offset size in a pass
+		double smoothing_tolerance;
+
+		bool use_taubin;
+		double taubin_pass_band;
+		size_t taubin_steps;
+
+		OffsetOptions() :
+			offset_size(0),
+			n_layers(1),
+			growth_rate(1.5),
+			write_intermediate(false),
+			use_tangents(true),
+			use_length(true),
+			use_inverse_length(false),
+			use_sqrt_length(false),
+			use_angle(true),
+			use_inverse_angle(false),
+			use_sqrt_angle(false),
+			use_original_offset(false),
+			use_offset_skew_fix(false),
+			use_future_intersections(false),
+			use_global_repair(false),
+			repair_tolerance(1e-6),
+			max_lambda(0.5),
+			max_normals_skew_angle(30),
+			use_skew_restriction(true),
+			max_skew_angle(30),
+			max_relaxed_skew_angle(45),
+			tetgen_min_ratio(1.03),
+			smoothing_tolerance(0),
+			use_taubin(false),
+			taubin_pass_band(0.1),
+			taubin_steps(20) {};
+	};
+
+	// Prism layers grown from a surface. Points of the surface come first in
+	// volume, and top gives the point of each surface point in the last layer
+	struct OffsetLayers {
+		unstruc::Grid volume;
+		unstruc::Grid outer_surface;
+		std::vector <unstruc::Index> top;
+
+		OffsetLayers() : volume(3), outer_surface(3) {};
+	};
+
+	// The surface must be oriented, as orient_surfaces leaves it. It is only
+	// read, so it can be shared between runs
+	OffsetLayers create_offset_layers(const unstruc::Grid& surface, const OffsetOptions& options);
+
+	// Tetrahedral mesh from the outer surface of the layers to a farfield box,
+	// combined with the layers and with the surface and farfield markers
+	unstruc::Grid create_farfield_mesh(const unstruc::Grid& surface, const OffsetLayers& layers, const std::vector <unstruc::Point>& holes, const OffsetOptions& options);
+}
+
+#endif
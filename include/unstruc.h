@@ -2,12 +2,17 @@
 #define UNSTRUC_H_D1F4865E_E889_4FD3_8CE1_C4D1D999C8CC
 
 #include "unstruc/grid.h"
+#include "unstruc/gridview.h"
 #include "unstruc/element.h"
 #include "unstruc/error.h"
 #include "unstruc/io.h"
 #include "unstruc/vtk.h"
+#include "unstruc/vtu.h"
 #include "unstruc/point.h"
 #include "unstruc/intersections.h"
+#include "unstruc/inside.h"
+#include "unstruc/halfedge.h"
 #include "unstruc/quality.h"
+#include "unstruc/volumes.h"
 
 #endif
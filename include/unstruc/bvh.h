@@ -0,0 +1,101 @@
+#ifndef BVH_H_8E2F6C1B_47A9_4E0D_B3C5_2D9A71F4E6B8
+#define BVH_H_8E2F6C1B_47A9_4E0D_B3C5_2D9A71F4E6B8
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+#include "point.h"
+#include "index.h"
+
+namespace unstruc {
+
+	// Bounding volume hierarchy over the axis aligned boxes of a set of
+	// primitives. The tree is stored in flat arrays and refers to primitives by
+	// index only. Children are always stored after their parent, so the boxes
+	// can be refit by walking the nodes backwards
+	struct BVH {
+		struct Node {
+			Point min, max;
+			Index first; // first child for inner nodes, first entry in primitives for leaves
+			Index n;     // number of primitives in a leaf, 0 for inner nodes
+		};
+
+		std::vector <Node> nodes;
+		std::vector <Index> primitives;
+		std::vector <Index> parents; // max_index for the root
+
+		// Builds the tree with median splits along the longest axis of the
+		// primitive centers
+		void build(const std::vector <Point>& mins, const std::vector <Point>& maxs, size_t leaf_size = 4);
+
+		// Recomputes the node boxes after the primitive boxes have moved. The
+		// tree structure is kept, so queries stay exact but may get slower if
+		// the primitives move far
+		void refit(const std::vector <Point>& mins, const std::vector <Point>& maxs);
+
+		// Like refit, but only recomputes the given leaves and their ancestors,
+		// so the cost scales with the number of leaves that moved
+		void refit_leaves(const std::vector <Index>& leaves, const std::vector <Point>& mins, const std::vector <Point>& maxs);
+
+		// Calls f(node) for every leaf whose box overlaps [min,max]. Boxes that
+		// only touch count as overlapping
+		template <typename F>
+		void query_leaves(const Point& min, const Point& max, F f) const {
+			if (nodes.empty()) return;
+			Index stack[64];
+			size_t n_stack = 0;
+			stack[n_stack++] = 0;
+			while (n_stack) {
+				Index i_node = stack[--n_stack];
+				const Node& node = nodes[i_node];
+				if (min.x > node.max.x || min.y > node.max.y || min.z > node.max.z) continue;
+				if (max.x < node.min.x || max.y < node.min.y || max.z < node.min.z) continue;
+				if (node.n) {
+					f(i_node);
+				} else {
+					stack[n_stack++] = node.first + 1;
+					stack[n_stack++] = node.first;
+				}
+			}
+		}
+
+		// Calls f(i) for every primitive i in a leaf whose box the ray from
+		// origin along dir passes through. inv_dir holds 1/dir per component
+		template <typename F>
+		void query_ray(const Point& origin, const Vector& inv_dir, F f) const {
+			if (nodes.empty()) return;
+			Index stack[64];
+			size_t n_stack = 0;
+			stack[n_stack++] = 0;
+			while (n_stack) {
+				const Node& node = nodes[stack[--n_stack]];
+				double tx1 = (node.min.x - origin.x)*inv_dir.x, tx2 = (node.max.x - origin.x)*inv_dir.x;
+				double ty1 = (node.min.y - origin.y)*inv_dir.y, ty2 = (node.max.y - origin.y)*inv_dir.y;
+				double tz1 = (node.min.z - origin.z)*inv_dir.z, tz2 = (node.max.z - origin.z)*inv_dir.z;
+				double t_min = std::max(std::max(std::min(tx1,tx2),std::min(ty1,ty2)),std::min(tz1,tz2));
+				double t_max = std::min(std::min(std::max(tx1,tx2),std::max(ty1,ty2)),std::max(tz1,tz2));
+				if (t_max < 0 || t_min > t_max) continue;
+				if (node.n) {
+					for (Index i = node.first; i < node.first + node.n; ++i)
+						f(primitives[i]);
+				} else {
+					stack[n_stack++] = node.first + 1;
+					stack[n_stack++] = node.first;
+				}
+			}
+		}
+
+		// Calls f(i) for every primitive i in a leaf overlapping [min,max]
+		template <typename F>
+		void query(const Point& min, const Point& max, F f) const {
+			query_leaves(min, max, [&](Index i_node) {
+				const Node& node = nodes[i_node];
+				for (Index i = node.first; i < node.first + node.n; ++i)
+					f(primitives[i]);
+			});
+		}
+	};
+}
+
+#endif
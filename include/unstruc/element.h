@@ -1,13 +1,17 @@
 #ifndef ELEMENT_H_DFA32621_EEB4_401F_8C3B_FA778CAD6F42
 #define ELEMENT_H_DFA32621_EEB4_401F_8C3B_FA778CAD6F42
 
+#include <cstddef>
 #include <vector>
 #include <string>
 
+#include "index.h"
+
 namespace unstruc {
 
 	struct Point;
 	struct Grid;
+	struct ConstElementRef;
 
 	struct Shape {
 		std::string name;
@@ -31,27 +35,126 @@ namespace unstruc {
 
 	Shape::Type type_from_vtk_id(size_t vtk_id);
 
+	// Non-owning view of a contiguous run of values. Used for the point list of
+	// an element stored inside an ElementList
+	template <typename T>
+	struct Span {
+		T* first;
+		size_t n;
+
+		Span() : first(nullptr), n(0) {};
+		Span(T* first, size_t n) : first(first), n(n) {};
+
+		inline T* begin() const { return first; };
+		inline T* end() const { return first + n; };
+		inline size_t size() const { return n; };
+		inline bool empty() const { return n == 0; };
+		inline T& operator[](size_t i) const { return first[i]; };
+	};
 
 	struct Element
 	{
 		Shape::Type type;
 		int name_i;
-		std::vector<size_t> points;
+		std::vector<Index> points;
 
 		Element() : type(Shape::Type::Undefined), name_i(0) {};
 		Element(Shape::Type T);
+		explicit Element(const ConstElementRef& e);
 
 		double calc_volume(const Grid& grid) const;
 	};
 
-	void dump(const Element &e);
-	void dump(const Element &e, const Grid& grid);
-	bool same(Element e1, Element e2);
+	// References to an element either stored in an ElementList or in a
+	// standalone Element. The references are invalidated if the underlying
+	// storage is resized
+	struct ConstElementRef
+	{
+		const Shape::Type& type;
+		const int& name_i;
+		Span<const Index> points;
+
+		ConstElementRef(const Shape::Type& type, const int& name_i, Span<const Index> points) : type(type), name_i(name_i), points(points) {};
+		ConstElementRef(const Element& e) : type(e.type), name_i(e.name_i), points(e.points.data(),e.points.size()) {};
+
+		double calc_volume(const Grid& grid) const;
+	};
+
+	struct ElementRef
+	{
+		Shape::Type& type;
+		int& name_i;
+		Span<Index> points;
+
+		ElementRef(Shape::Type& type, int& name_i, Span<Index> points) : type(type), name_i(name_i), points(points) {};
+		ElementRef(Element& e) : type(e.type), name_i(e.name_i), points(e.points.data(),e.points.size()) {};
+		operator ConstElementRef() const { return ConstElementRef(type,name_i,Span<const Index>(points.first,points.n)); };
+
+		double calc_volume(const Grid& grid) const { return ConstElementRef(*this).calc_volume(grid); };
+	};
+
+	// Compressed row storage for the elements of a grid. The points of element i
+	// are connectivity[offsets[i]] to connectivity[offsets[i+1]-1]. Offsets are
+	// size_t since the connectivity can be longer than the index range
+	struct ElementList
+	{
+		std::vector <Shape::Type> types;
+		std::vector <int> name_indices;
+		std::vector <size_t> offsets;
+		std::vector <Index> connectivity;
+
+		template <typename List, typename Ref>
+		struct Iterator {
+			List* list;
+			size_t i;
+			Iterator(List* list, size_t i) : list(list), i(i) {};
+			inline Ref operator*() const { return (*list)[i]; };
+			inline Iterator& operator++() { ++i; return *this; };
+			inline bool operator==(const Iterator& other) const { return i == other.i; };
+			inline bool operator!=(const Iterator& other) const { return i != other.i; };
+		};
+		typedef Iterator<ElementList,ElementRef> iterator;
+		typedef Iterator<const ElementList,ConstElementRef> const_iterator;
+
+		ElementList() : offsets(1,0) {};
+
+		inline size_t size() const { return types.size(); };
+		inline bool empty() const { return types.empty(); };
+		inline size_t n_points(size_t i) const { return offsets[i+1] - offsets[i]; };
+
+		inline ElementRef operator[](size_t i) {
+			return ElementRef(types[i],name_indices[i],Span<Index>(connectivity.data() + offsets[i],n_points(i)));
+		};
+		inline ConstElementRef operator[](size_t i) const {
+			return ConstElementRef(types[i],name_indices[i],Span<const Index>(connectivity.data() + offsets[i],n_points(i)));
+		};
+		inline ElementRef back() { return (*this)[size()-1]; };
+		inline ConstElementRef back() const { return (*this)[size()-1]; };
+
+		inline iterator begin() { return iterator(this,0); };
+		inline iterator end() { return iterator(this,size()); };
+		inline const_iterator begin() const { return const_iterator(this,0); };
+		inline const_iterator end() const { return const_iterator(this,size()); };
+
+		void clear();
+		void reserve(size_t n_elements, size_t n_connectivity);
+		void reserve(size_t n_elements) { reserve(n_elements,4*n_elements); };
+		void resize(size_t n_elements);
+		ElementRef emplace_back(Shape::Type type, int name_i = 0, size_t n_points = 0);
+		void push_back(ConstElementRef e);
+		void append(const ElementList& other, Index point_offset = 0, int name_offset = 0);
+		void erase(const std::vector <bool>& erased);
+		void swap(ElementList& other);
+	};
+
+	void dump(ConstElementRef e);
+	void dump(ConstElementRef e, const Grid& grid);
+	bool same(ConstElementRef e1, ConstElementRef e2);
 
-	bool can_collapse(const Element& e);
+	bool can_collapse(ConstElementRef e);
 	bool collapse(Element& e,std::vector<Element>& new_elements);
 
-	bool can_collapse_wo_split(const Element& e);
+	bool can_collapse_wo_split(ConstElementRef e);
 	bool collapse_wo_split(Element& e);
 
 }
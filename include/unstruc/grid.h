@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <utility>
 
 #include "point.h"
 #include "element.h"
@@ -17,7 +18,7 @@ namespace unstruc {
 
 	struct Grid {
 		std::vector <Point> points;
-		std::vector <Element> elements;
+		ElementList elements;
 		std::vector <Name> names;
 		size_t dim;
 
@@ -27,13 +28,26 @@ namespace unstruc {
 		void delete_inner_faces();
 		void collapse_elements(bool split);
 		Grid& operator+=(const Grid&);
-		Grid operator+(const Grid& other) const { return Grid(*this) += other; };
+		// Takes over the storage of other if this grid has no points or elements.
+		// Otherwise the points and elements are copied and the names moved
+		Grid& operator+=(Grid&& other);
+		Grid operator+(const Grid& other) const & { Grid grid (*this); grid += other; return grid; };
+		Grid operator+(const Grid& other) && { return std::move(*this += other); };
+		Grid operator+(Grid&& other) const & { Grid grid (*this); grid += std::move(other); return grid; };
+		Grid operator+(Grid&& other) && { return std::move(*this += std::move(other)); };
+		// Appends the grids in order, after reserving space for all of them
+		void append(const std::vector <const Grid*>& others);
 		void delete_empty_names();
 		bool test_point_inside(Point const& p);
 		bool check_integrity() const;
 		Point get_bounding_min() const;
 		Point get_bounding_max() const;
-		Grid grid_from_element_index(const std::vector <size_t>& element_index) const;
+		Grid grid_from_element_index(const std::vector <Index>& element_index) const;
+
+		// Labels every element with the connected component it belongs to, where
+		// elements sharing a point are connected. Components are numbered from 0
+		// in order of their first element
+		std::vector <Index> connected_components(size_t& n_components) const;
 	};
 }
 
@@ -0,0 +1,41 @@
+#ifndef GRIDVIEW_H_9E3C4B71_58A2_4D0F_B6E9_2C71F4A8D05B
+#define GRIDVIEW_H_9E3C4B71_58A2_4D0F_B6E9_2C71F4A8D05B
+
+#include <cstddef>
+#include <vector>
+
+#include "index.h"
+#include "element.h"
+
+namespace unstruc {
+	struct Grid;
+
+	// A subset of the elements of a grid that doesn't copy the grid. The view
+	// refers to both the grid and the element index list, so they must
+	// outlive it. Element and point indices are those of the parent grid
+	struct GridView {
+		const Grid& grid;
+		Span<const Index> element_index;
+
+		GridView(const Grid& grid, const std::vector <Index>& element_index);
+		// Views of temporaries would dangle
+		GridView(const Grid& grid, std::vector <Index>&& element_index) = delete;
+		GridView(Grid&& grid, const std::vector <Index>& element_index) = delete;
+
+		inline size_t size() const { return element_index.size(); };
+		ConstElementRef operator[](size_t i) const;
+
+		// Points used by the viewed elements, in increasing order
+		std::vector <Index> used_points() const;
+
+		// Grid holding copies of the viewed elements and only the points they
+		// use, numbered in the order of used_points
+		Grid compact() const;
+
+		// Grid holding copies of the viewed elements and every point of the
+		// parent grid, so point indices are unchanged
+		Grid to_grid() const;
+	};
+}
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef HALFEDGE_H_6B1E0C94_2D7A_4F35_9C8B_E4A07D3F52C1
+#define HALFEDGE_H_6B1E0C94_2D7A_4F35_9C8B_E4A07D3F52C1
+
+#include <cstddef>
+#include <vector>
+
+#include "index.h"
+
+namespace unstruc {
+	struct Grid;
+
+	// Half-edge connectivity of a surface grid. Half-edge h is the edge that
+	// starts at connectivity[h] of the grid's element list and runs to the
+	// next point of the same element, so it has the same index as the point
+	// it starts at. The structure is a snapshot and must be rebuilt if the
+	// element connectivity changes
+	struct HalfEdgeSurface {
+		std::vector <Index> origin;
+		std::vector <Index> next;
+		std::vector <Index> prev;
+		std::vector <Index> element;
+		std::vector <Index> twin; // max_index on boundary and non-manifold edges
+
+		// Half-edges leaving point p are point_half_edges[point_offsets[p]] to
+		// point_half_edges[point_offsets[p+1]-1], in element order
+		std::vector <size_t> point_offsets;
+		std::vector <Index> point_half_edges;
+
+		// Half-edges without a partner, and half-edges on edges shared by more
+		// than two elements
+		std::vector <Index> boundary_half_edges;
+		std::vector <Index> nonmanifold_half_edges;
+
+		HalfEdgeSurface(const Grid& surface);
+
+		inline Index target(Index h) const { return origin[next[h]]; };
+		inline size_t n_point_half_edges(Index p) const { return point_offsets[p+1] - point_offsets[p]; };
+
+		// True if h and its twin run in opposite directions, as they do when the
+		// two elements are oriented the same way
+		inline bool consistent(Index h) const { return origin[twin[h]] != origin[h]; };
+
+		// Number of elements met when walking around point p from element to
+		// element across shared edges. Equal to the number of elements using p
+		// if they form a single fan
+		size_t fan_size(Index p) const;
+
+		// Works out which elements need to be flipped so that every connected
+		// surface is oriented like its first element. Returns false if some
+		// surface can't be oriented consistently
+		bool orient(std::vector <bool>& flip) const;
+	};
+}
+
+#endif
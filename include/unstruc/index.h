@@ -0,0 +1,25 @@
+#ifndef INDEX_H_09836362_23B1_4DCF_A185_DBF3697E1982
+#define INDEX_H_09836362_23B1_4DCF_A185_DBF3697E1982
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace unstruc {
+
+	// Type used to store point and element indices. 32 bit indices halve the
+	// memory used for connectivity, so they are the default. Define
+	// UNSTRUC_64BIT_INDEX (cmake -DUNSTRUC_64BIT_INDEX=ON) for meshes with more
+	// than 4 billion points or elements
+#ifdef UNSTRUC_64BIT_INDEX
+	typedef uint64_t Index;
+#else
+	typedef uint32_t Index;
+#endif
+
+	const Index max_index = std::numeric_limits<Index>::max();
+
+	void check_index_range(size_t n);
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef INSIDE_H_3A9D5E27_C1B4_4F86_A0E3_7D24B96F158C
+#define INSIDE_H_3A9D5E27_C1B4_4F86_A0E3_7D24B96F158C
+
+#include <vector>
+
+#include "point.h"
+#include "index.h"
+#include "bvh.h"
+
+namespace unstruc {
+	struct Grid;
+
+	// Tests whether points are inside a closed triangle surface by counting
+	// how many triangles a ray from the point crosses. The triangles are kept
+	// in a BVH, so each query only looks at the triangles near the ray. The
+	// orientation of the triangles doesn't matter
+	struct InsideTest {
+		std::vector <Point> points; // three per triangle
+		BVH tree;
+
+		InsideTest(const Grid& surface);
+		InsideTest(const Grid& surface, const std::vector <Index>& elements);
+		bool inside(const Point& p) const;
+	};
+}
+
+#endif
@@ -1,24 +1,50 @@
 #ifndef INTERSECTIONS_H_01DF6924_DFF5_4B85_B728_5007A3EB409C
 #define INTERSECTIONS_H_01DF6924_DFF5_4B85_B728_5007A3EB409C
 
+#include <cstddef>
 #include <vector>
+#include <memory>
+
+#include "index.h"
 
 namespace unstruc {
 	struct Grid;
+	struct GridView;
 	struct Vector;
 
-	typedef std::pair<size_t,size_t> PointPair;
+	typedef std::pair<Index,Index> PointPair;
 	typedef std::vector < PointPair > PointPairList;
 
 	struct Intersections {
-		std::vector <size_t> points;
-		std::vector <size_t> elements;
+		std::vector <Index> points;
+		std::vector <Index> elements;
 
 		static Intersections find(const Grid& grid);
+		// Only looks for intersections between the viewed elements. Points and
+		// elements are indices into the grid
+		static Intersections find(const GridView& view);
 		static Intersections find_with_octree(const Grid& grid);
 		static PointPairList find_future(const Grid& surface, Grid offset);
 		static double get_scale_factor(double distance);
 	};
+
+	// Keeps the edges, faces and search trees of a grid between checks. Each
+	// update only retests the edges and faces that touch points which moved
+	// since the last update, so repeated checks of a grid whose points move a
+	// little at a time are much cheaper than find_with_octree. The elements
+	// of the grid must not change after the tracker is created
+	struct IntersectionTracker {
+		IntersectionTracker(const Grid& grid);
+		~IntersectionTracker();
+
+		Intersections update(const Grid& grid);
+
+		// Number of points that moved in the last update
+		size_t n_moved_points;
+
+		struct Data;
+		std::unique_ptr<Data> data;
+	};
 }
 
 #endif
@@ -5,6 +5,7 @@
 
 namespace unstruc {
 	struct Grid;
+	struct GridView;
 
 	enum struct FileType {
 		Unknown,
@@ -16,12 +17,16 @@ namespace unstruc {
 		STLB,
 		GMSH,
 		CGNS2,
+		VTU,
+		PVTU,
 		Count
 	};
 
 	FileType filetype_from_filename(const std::string& filename);
 	Grid read_grid(const std::string& filename);
 	void write_grid(const std::string& filename,const Grid& grid);
+	// Writes the viewed elements and only the points they use
+	void write_grid(const std::string& filename,const GridView& view);
 }
 
 #endif
@@ -0,0 +1,78 @@
+#ifndef LEXER_H_1C7E5B93_4D2A_4E86_9F31_B8A06D2C7E45
+#define LEXER_H_1C7E5B93_4D2A_4E86_9F31_B8A06D2C7E45
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace unstruc {
+
+	struct Token {
+		const char* begin;
+		const char* end;
+
+		Token() : begin(nullptr), end(nullptr) {};
+		Token(const char* begin, const char* end) : begin(begin), end(end) {};
+
+		inline size_t size() const { return end - begin; };
+		inline bool empty() const { return begin == end; };
+		inline bool operator==(const char* s) const { return strlen(s) == size() && memcmp(s,begin,size()) == 0; };
+		inline bool operator!=(const char* s) const { return !(*this == s); };
+		inline std::string str() const { return std::string(begin,end); };
+	};
+
+	// Parses the whole of [begin,end) as a number. Doubles are rounded the
+	// same way as strtod
+	bool parse_double(const char* begin, const char* end, double& v);
+	bool parse_integer(const char* begin, const char* end, int64_t& v);
+
+	inline bool is_whitespace(char c) { return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f'; };
+
+	// Splits a block of text into whitespace separated tokens without copying
+	struct Lexer {
+		const char* p;
+		const char* end;
+
+		Lexer(const char* begin, const char* end) : p(begin), end(end) {};
+
+		inline void skip_whitespace() {
+			while (p != end && is_whitespace(*p))
+				++p;
+		};
+
+		// Empty once the text runs out
+		inline Token next() {
+			skip_whitespace();
+			const char* begin = p;
+			while (p != end && !is_whitespace(*p))
+				++p;
+			return Token(begin,p);
+		};
+
+		// The rest of the current line, without surrounding whitespace
+		Token rest_of_line() {
+			while (p != end && *p != '\n' && is_whitespace(*p))
+				++p;
+			const char* begin = p;
+			while (p != end && *p != '\n')
+				++p;
+			const char* last = p;
+			while (last != begin && is_whitespace(last[-1]))
+				--last;
+			return Token(begin,last);
+		};
+
+		inline bool next_double(double& v) {
+			Token t = next();
+			return parse_double(t.begin,t.end,v);
+		};
+
+		inline bool next_integer(int64_t& v) {
+			Token t = next();
+			return parse_integer(t.begin,t.end,v);
+		};
+	};
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef MAPPEDFILE_H_8F2C41D7_6A3E_4B95_A0D8_5E17C93B62F4
+#define MAPPEDFILE_H_8F2C41D7_6A3E_4B95_A0D8_5E17C93B62F4
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace unstruc {
+
+	// Read only view of a whole file. The file is memory mapped where the
+	// platform supports it and read into memory otherwise
+	struct MappedFile {
+		const char* data;
+		size_t size;
+
+		MappedFile(const std::string& filename);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		const char* begin() const { return data; };
+		const char* end() const { return data + size; };
+
+	private:
+		void* mapping;
+		std::vector <char> buffer;
+	};
+}
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef PARALLEL_H_5C0B2E7A_3F41_4D6B_9E2A_61B8C4F0D9A3
+#define PARALLEL_H_5C0B2E7A_3F41_4D6B_9E2A_61B8C4F0D9A3
+
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+
+namespace unstruc {
+
+	// Number of threads used by the parallel algorithms. Defaults to the number
+	// of hardware threads and can be overridden with the UNSTRUC_NUM_THREADS
+	// environment variable or set_n_threads. Setting zero restores the default
+	size_t get_n_threads();
+	void set_n_threads(size_t n);
+
+	// Number of chunks parallel_chunks splits n items into
+	inline size_t parallel_chunk_count(size_t n, size_t min_chunk = 1024) {
+		return std::min(get_n_threads(), (n + min_chunk - 1) / min_chunk);
+	}
+
+	// Splits [0,n) into n_chunks contiguous chunks and calls f(chunk, begin,
+	// end) for each of them. Passes whose per chunk results have to line up
+	// should all use one n_chunks, since the thread count can change between
+	// calls
+	template <typename F>
+	void parallel_chunks_n(size_t n, size_t n_chunks, F f) {
+		if (n_chunks <= 1) {
+			f(0, 0, n);
+			return;
+		}
+		std::vector<std::thread> threads;
+		threads.reserve(n_chunks - 1);
+		for (size_t c = 1; c < n_chunks; ++c) {
+			size_t begin = c * n / n_chunks;
+			size_t end = (c + 1) * n / n_chunks;
+			threads.push_back(std::thread([&f, c, begin, end]() { f(c, begin, end); }));
+		}
+		f(0, 0, n / n_chunks);
+		for (std::thread& t : threads)
+			t.join();
+	}
+
+	// Splits [0,n) into at most get_n_threads() contiguous chunks of at least
+	// min_chunk items and calls f(chunk, begin, end) for each of them. Chunk i
+	// always covers items before chunk i+1, so per chunk results can be
+	// combined in a deterministic order
+	template <typename F>
+	void parallel_chunks(size_t n, F f, size_t min_chunk = 1024) {
+		parallel_chunks_n(n, parallel_chunk_count(n, min_chunk), f);
+	}
+
+	// Calls f(i) for every i in [0,n)
+	template <typename F>
+	void parallel_for(size_t n, F f, size_t min_chunk = 1024) {
+		parallel_chunks(n, [&f](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i)
+				f(i);
+		}, min_chunk);
+	}
+
+	// Calls f(thread, i) for every i in [0,n), where thread is below
+	// max_threads. Threads take blocks of grain items from a shared counter,
+	// which balances the load when the cost per item varies. Per thread
+	// results should be sized from the same max_threads
+	template <typename F>
+	void parallel_for_dynamic_n(size_t n, size_t max_threads, F f, size_t grain = 64) {
+		size_t n_threads = std::min(max_threads, (n + grain - 1) / grain);
+		if (n_threads <= 1) {
+			for (size_t i = 0; i < n; ++i)
+				f(0, i);
+			return;
+		}
+		std::atomic<size_t> next (0);
+		auto work = [&f, &next, n, grain](size_t thread) {
+			while (true) {
+				size_t begin = next.fetch_add(grain);
+				if (begin >= n) break;
+				size_t end = std::min(begin + grain, n);
+				for (size_t i = begin; i < end; ++i)
+					f(thread, i);
+			}
+		};
+		std::vector<std::thread> threads;
+		threads.reserve(n_threads - 1);
+		for (size_t t = 1; t < n_threads; ++t)
+			threads.push_back(std::thread(work, t));
+		work(0);
+		for (std::thread& t : threads)
+			t.join();
+	}
+
+	// As parallel_for_dynamic_n, with thread below get_n_threads()
+	template <typename F>
+	void parallel_for_dynamic(size_t n, F f, size_t grain = 64) {
+		parallel_for_dynamic_n(n, get_n_threads(), f, grain);
+	}
+
+	// Sorts chunks of the range in parallel and then merges them pairwise.
+	// Like std::sort this is not stable, so comp should be a total order when
+	// the result needs to be reproducible
+	template <typename Iterator, typename Compare>
+	void parallel_sort(Iterator first, Iterator last, Compare comp, size_t min_chunk = 16384) {
+		size_t n = last - first;
+		size_t n_parts = std::min(get_n_threads(), n / min_chunk);
+		if (n_parts <= 1) {
+			std::sort(first, last, comp);
+			return;
+		}
+		std::vector<size_t> bounds (n_parts + 1);
+		for (size_t i = 0; i <= n_parts; ++i)
+			bounds[i] = i * n / n_parts;
+
+		parallel_for(n_parts, [&](size_t i) {
+			std::sort(first + bounds[i], first + bounds[i+1], comp);
+		}, 1);
+
+		for (size_t width = 1; width < n_parts; width *= 2) {
+			size_t n_merges = (n_parts + 2*width - 1) / (2*width);
+			parallel_for(n_merges, [&](size_t m) {
+				size_t lo = 2*width*m;
+				size_t mid = std::min(lo + width, n_parts);
+				size_t hi = std::min(lo + 2*width, n_parts);
+				if (mid < hi)
+					std::inplace_merge(first + bounds[lo], first + bounds[mid], first + bounds[hi], comp);
+			}, 1);
+		}
+	}
+}
+
+#endif
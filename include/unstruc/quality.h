@@ -1,10 +1,14 @@
 #ifndef QUALITY_H_C8106684_0039_4CFA_B712_5B9457E0509C
 #define QUALITY_H_C8106684_0039_4CFA_B712_5B9457E0509C
 
+#include <cstddef>
 #include <vector>
 
+#include "index.h"
+
 namespace unstruc {
 	struct Grid;
+	struct GridView;
 
 	struct MinMax {
 		double min, max;
@@ -24,10 +28,12 @@ namespace unstruc {
 		MinMax face_angle;
 		MinMax dihedral_angle;
 
-		std::vector<size_t> bad_elements;
+		std::vector<Index> bad_elements;
 	};
 
 	MeshQuality get_mesh_quality(const Grid& grid, double threshold);
+	// Only checks the viewed elements. Bad elements are indices into the grid
+	MeshQuality get_mesh_quality(const GridView& view, double threshold);
 }
 
 #endif
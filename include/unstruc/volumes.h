@@ -0,0 +1,51 @@
+#ifndef VOLUMES_H_47D2A8F3_6B1C_4E95_A0D7_8C3E5F91B26A
+#define VOLUMES_H_47D2A8F3_6B1C_4E95_A0D7_8C3E5F91B26A
+
+#include <cstddef>
+#include <vector>
+
+#include "index.h"
+#include "point.h"
+
+namespace unstruc {
+	struct Grid;
+
+	// Signed volume of a single element of each shape, from the points and
+	// the element's point list
+	double tetra_volume(const Point* points, const Index* e);
+	double pyramid_volume(const Point* points, const Index* e);
+	double wedge_volume(const Point* points, const Index* e);
+	double hexa_volume(const Point* points, const Index* e);
+
+	// Signed volume of every element, evaluated in parallel. Runs of elements
+	// with the same shape are handed to that shape's kernel as a batch.
+	// Elements without volume give zero
+	std::vector <double> calc_volumes(const Grid& grid);
+
+	// Elements with negative volume, in increasing order
+	std::vector <Index> find_negative_volumes(const Grid& grid);
+
+	// Keeps the volume of every element between checks. Each update only
+	// re-evaluates the elements that use points which moved since the last
+	// update, and keeps the set of negative elements up to date. The elements
+	// of the grid must not change after the tracker is created
+	struct NegativeVolumeTracker {
+		std::vector <Point> points; // Positions at the last update
+		std::vector <double> volumes;
+		std::vector <Index> negative; // In increasing order
+
+		// Elements using each point
+		std::vector <size_t> point_offsets;
+		std::vector <Index> point_elements;
+
+		// Number of elements re-evaluated in the last update
+		size_t n_updated_elements;
+
+		NegativeVolumeTracker(const Grid& grid);
+
+		// Returns the elements with negative volume, in increasing order
+		const std::vector <Index>& update(const Grid& grid);
+	};
+}
+
+#endif
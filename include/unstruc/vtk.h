@@ -8,14 +8,18 @@ namespace unstruc {
 	struct Grid;
 	struct Vector;
 
-	bool vtk_write(const std::string& filename, const Grid &grid);
+	// Legacy VTK files are written in the big-endian binary format unless
+	// binary is false. Data appended with vtk_write_data must use the same
+	// format as the grid. vtk_read reads either format
+	bool vtk_write(const std::string& filename, const Grid &grid, bool binary = true);
+	bool vtk_write_ascii(const std::string& filename, const Grid &grid);
 	Grid vtk_read(const std::string& filename);
 
 	void vtk_write_point_data_header(const std::string& filename, const Grid &grid);
 	void vtk_write_cell_data_header(const std::string& filename, const Grid &grid);
-	void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <size_t>& scalars);
-	void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <double>& scalars);
-	void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <Vector>& vectors);
+	void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <size_t>& scalars, bool binary = true);
+	void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <double>& scalars, bool binary = true);
+	void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <Vector>& vectors, bool binary = true);
 }
 
 #endif
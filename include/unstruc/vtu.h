@@ -0,0 +1,39 @@
+#ifndef VTU_H_E5A82D17_93C6_4B0F_8D41_2F6C07B9A3E8
+#define VTU_H_E5A82D17_93C6_4B0F_8D41_2F6C07B9A3E8
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace unstruc {
+	struct Grid;
+	struct Vector;
+
+	// Point and cell data for a VTK XML file. Arrays are referenced rather
+	// than copied, so they must outlive the write
+	struct VtuData {
+		struct Array {
+			std::string name;
+			size_t n_components;
+			size_t n_tuples;
+			const double* values;
+		};
+		std::vector <Array> point_data;
+		std::vector <Array> cell_data;
+
+		void add_point_data(const std::string& name, const std::vector <double>& scalars);
+		void add_point_data(const std::string& name, const std::vector <Vector>& vectors);
+		void add_cell_data(const std::string& name, const std::vector <double>& scalars);
+		void add_cell_data(const std::string& name, const std::vector <Vector>& vectors);
+	};
+
+	// Unstructured grid file with all arrays appended as raw binary
+	void vtu_write(const std::string& filename, const Grid& grid, const VtuData& data = VtuData());
+
+	// Splits the elements into n_pieces contiguous ranges, each written to its
+	// own .vtu file with the points it uses, and writes a .pvtu file that
+	// lists them. The pieces are written at the same time
+	void pvtu_write(const std::string& filename, const Grid& grid, size_t n_pieces, const VtuData& data = VtuData());
+}
+
+#endif
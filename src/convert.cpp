@@ -53,7 +53,7 @@ void applyTranslation(Grid &grid, TranslationTable &transt) {
     }
   }
   for (size_t i = 0; i < grid.elements.size(); i++) {
-    Element &e = grid.elements[i];
+    ElementRef e = grid.elements[i];
     if (e.name_i != -1 && transt.translate[e.name_i]) e.name_i = transt.index[e.name_i];
   }
 }
@@ -61,7 +61,7 @@ void applyTranslation(Grid &grid, TranslationTable &transt) {
 void print_usage () {
   std::cerr <<
     "unstruc-convert [options] output_file input_file [input_file ...]\n\n"
-    "This tool converts between file formats typically used in CFD analysis. Currently supported input file types are Plot3D (.xyz or .p3d) and SU2 (.su2). Currently supported output file types are SU2 (.su2) and VTK (.vtk)\n"
+    "This tool converts between file formats typically used in CFD analysis. Currently supported input file types are Plot3D (.xyz or .p3d) and SU2 (.su2). Currently supported output file types are SU2 (.su2), VTK (.vtk) and VTK XML (.vtu or .pvtu)\n"
     "Option Arguments\n"
     "-m                   Attempt to merge points that are close together\n"
     "-s scale_factor      Scale model by a factor\n"
@@ -115,10 +115,9 @@ int main (int argc, char* argv[])
     fatal("Must specify input file[s]");
   }
   std::string outputfile (c_outputfile);
-  Grid grid;
-  for (size_t i = 0; i < inputfiles.size(); ++i) {
-    grid = read_grid(inputfiles[i]);
-  }
+  Grid grid = read_grid(inputfiles[0]);
+  for (size_t i = 1; i < inputfiles.size(); ++i)
+    grid += read_grid(inputfiles[i]);
   if (scale_factor != 1)
     fprintf(stderr,"Scaling mesh by %gx\n",scale_factor);
   for (Point& p : grid.points) {
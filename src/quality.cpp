@@ -54,8 +54,7 @@ int main(int argc, char* argv[]) {
   if (quality.bad_elements.size()) {
     printf("%lu Bad Elements\n",quality.bad_elements.size());
     if (!bad_elements_filename.empty()) {
-      Grid bad = mesh.grid_from_element_index(quality.bad_elements);
-      write_grid(bad_elements_filename, bad);
+      write_grid(bad_elements_filename, GridView(mesh, quality.bad_elements).to_grid());
     }
   }
 }
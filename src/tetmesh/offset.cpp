@@ -0,0 +1,1158 @@
+#define _USE_MATH_DEFINES
+
+#include "offset.h"
+
+#include "unstruc.h"
+#include "unstruc/parallel.h"
+#include "surface.h"
+#include "volume.h"
+#include "farfield.h"
+
+#include <cassert>
+#include <algorithm>
+#include <climits>
+#include <cfloat>
+#include <cmath>
+#include <sstream>
+
+using namespace unstruc;
+
+namespace tetmesh {
+
+  namespace {
+    Grid volume_from_surfaces (const Grid& surface1, const Grid& surface2) {
+      if (surface1.elements.size() != surface2.elements.size())
+        fatal("surfaces don't match");
+      size_t npoints1 = surface1.points.size();
+
+      Grid volume (3);
+      volume.points = surface1.points;
+      volume.points.insert(volume.points.end(),surface2.points.begin(),surface2.points.end());
+      size_t n_negative = 0;
+      for (size_t i = 0; i < surface1.elements.size(); ++i) {
+        ConstElementRef e1 = surface1.elements[i];
+        ConstElementRef e2 = surface2.elements[i];
+        if (e1.type != e2.type)
+          fatal("elements in surfaces don't match");
+        if (e1.type == Shape::Triangle) {
+          ElementRef e = volume.elements.emplace_back(Shape::Wedge);
+          for (size_t j = 0; j < 3; ++j) {
+            e.points[2-j] = e1.points[j];
+            e.points[5-j] = e2.points[j] + npoints1;
+          }
+          if (e.calc_volume(volume) < 0) n_negative++;
+        } else {
+          fprintf(stderr,"%s\n",Shape::Info[e1.type].name.c_str());
+          not_implemented("Must pass triangle surfaces");
+        }
+      }
+      return volume;
+    }
+
+    // Prism layers built on a single point array. A layer point that didn't move
+    // shares the point of the layer below, so the stack never needs merging.
+    // Each layer gets its own volume name, numbered from 1
+    struct PrismStack {
+      Grid volume;
+      std::vector <Index> top; // Point used by each surface point in the top layer
+
+      PrismStack(const Grid& surface) : volume(3), top(surface.points.size()) {
+        volume.points = surface.points;
+        for (size_t i = 0; i < top.size(); ++i)
+          top[i] = i;
+      };
+
+      // The offset surface must have the elements of the surface the stack was
+      // started with
+      void add_layer(const Grid& offset) {
+        if (offset.points.size() != top.size())
+          fatal("surfaces don't match");
+        std::vector <Index> bottom (top);
+        for (size_t i = 0; i < top.size(); ++i) {
+          if (!(offset.points[i] == volume.points[bottom[i]])) {
+            top[i] = volume.points.size();
+            volume.points.push_back(offset.points[i]);
+          }
+        }
+        int name_i = volume.names.size();
+        volume.names.push_back(Name(3,"default"));
+        for (ConstElementRef e : offset.elements) {
+          if (e.type != Shape::Triangle) {
+            fprintf(stderr,"%s\n",Shape::Info[e.type].name.c_str());
+            not_implemented("Must pass triangle surfaces");
+          }
+          ElementRef wedge = volume.elements.emplace_back(Shape::Wedge,name_i);
+          for (size_t j = 0; j < 3; ++j) {
+            wedge.points[2-j] = bottom[e.points[j]];
+            wedge.points[5-j] = top[e.points[j]];
+          }
+        }
+      };
+    };
+
+    // Appends other to grid with its points renumbered by point_map
+    void append_mapped(Grid& grid, const Grid& other, const std::vector <Index>& point_map) {
+      size_t connectivity_offset = grid.elements.connectivity.size();
+      int name_offset = grid.names.size();
+      grid.names.insert(grid.names.end(),other.names.begin(),other.names.end());
+      grid.elements.append(other.elements,0,name_offset);
+      parallel_for(grid.elements.connectivity.size() - connectivity_offset,[&](size_t i) {
+        Index& p = grid.elements.connectivity[connectivity_offset + i];
+        p = point_map[p];
+      });
+    }
+
+    // tetgen keeps its input points first and in order, so the points of the
+    // surfaces it meshed between can be found in its volume by index
+    void check_farfield_points(const Grid& farfield_volume, const Grid& inner_surface, const Grid& farfield_surface) {
+      size_t n_inner = inner_surface.points.size();
+      if (farfield_volume.points.size() < n_inner + farfield_surface.points.size())
+        fatal("Farfield volume is missing surface points");
+      for (size_t i = 0; i < n_inner; ++i) {
+        if (!(farfield_volume.points[i] == inner_surface.points[i]))
+          fatal("Farfield volume points don't match the surface");
+      }
+      for (size_t i = 0; i < farfield_surface.points.size(); ++i) {
+        if (!(farfield_volume.points[n_inner + i] == farfield_surface.points[i]))
+          fatal("Farfield volume points don't match the farfield surface");
+      }
+    }
+
+    struct PointWeight {
+      Index p;
+      double w;
+      PointWeight() : p(max_index), w(-1) {};
+      PointWeight(Index p, double w) : p(p), w(w) {};
+      bool operator<(const PointWeight& other) const { return p < other.p; };
+    };
+
+    struct PointConnection {
+      Vector orig_normal;
+      double current_adjustment;
+      double geometric_severity;
+      double min_offset_size;
+      double max_offset_size;
+      double geometric_stretch_factor;
+      double max_skew_angle;
+      bool convex;
+    };
+
+    // Connectivity of a surface and of every offset made from it, since offset
+    // surfaces keep the elements of the surface they were made from. Built once
+    // and shared by all layers. Corner c is the corner of element elements[c] at
+    // the point whose range of corners contains it, in element order
+    struct SurfaceTopology {
+      HalfEdgeSurface half_edges;
+
+      std::vector <Index> elements;
+      std::vector <Index> prev_points;
+      std::vector <Index> next_points;
+
+      // Neighbours of each point in increasing order, and the neighbour slots of
+      // the previous and next point of each corner
+      std::vector <size_t> neighbour_offsets;
+      std::vector <Index> neighbours;
+      std::vector <size_t> prev_slots;
+      std::vector <size_t> next_slots;
+
+      SurfaceTopology(const Grid& surface);
+
+      size_t corners_begin(size_t i) const { return half_edges.point_offsets[i]; };
+      size_t corners_end(size_t i) const { return half_edges.point_offsets[i+1]; };
+    };
+
+    SurfaceTopology::SurfaceTopology(const Grid& surface) : half_edges(surface) {
+      size_t n_points = surface.points.size();
+      size_t n_corners = half_edges.point_half_edges.size();
+      elements.resize(n_corners);
+      prev_points.resize(n_corners);
+      next_points.resize(n_corners);
+      parallel_for(n_corners,[&](size_t c) {
+        Index h = half_edges.point_half_edges[c];
+        elements[c] = half_edges.element[h];
+        prev_points[c] = half_edges.origin[half_edges.prev[h]];
+        next_points[c] = half_edges.target(h);
+      });
+
+      // Every neighbour of a point on a closed surface is met twice
+      std::vector< std::vector <Index> > point_neighbours (n_points);
+      parallel_for(n_points,[&](size_t i) {
+        std::vector <Index>& n = point_neighbours[i];
+        for (size_t c = corners_begin(i); c < corners_end(i); ++c) {
+          n.push_back(prev_points[c]);
+          n.push_back(next_points[c]);
+        }
+        std::sort(n.begin(),n.end());
+        n.erase(std::unique(n.begin(),n.end()),n.end());
+      });
+      neighbour_offsets.resize(n_points + 1);
+      neighbour_offsets[0] = 0;
+      for (size_t i = 0; i < n_points; ++i)
+        neighbour_offsets[i+1] = neighbour_offsets[i] + point_neighbours[i].size();
+      neighbours.resize(neighbour_offsets.back());
+      prev_slots.resize(n_corners);
+      next_slots.resize(n_corners);
+      parallel_for(n_points,[&](size_t i) {
+        const std::vector <Index>& n = point_neighbours[i];
+        std::copy(n.begin(),n.end(),neighbours.begin() + neighbour_offsets[i]);
+        for (size_t c = corners_begin(i); c < corners_end(i); ++c) {
+          prev_slots[c] = neighbour_offsets[i] + (std::lower_bound(n.begin(),n.end(),prev_points[c]) - n.begin());
+          next_slots[c] = neighbour_offsets[i] + (std::lower_bound(n.begin(),n.end(),next_points[c]) - n.begin());
+        }
+      });
+    }
+
+    // The neighbour weights and elements of each point are stored in compressed
+    // row format, so the smoothing passes only read and write flat arrays. A pass
+    // reads normals and writes next_normals, and the two are swapped afterwards
+    struct SmoothingData {
+      const SurfaceTopology& topology;
+      const OffsetOptions& options;
+
+      std::vector <PointConnection> connections;
+      std::vector <Vector> element_normals;
+
+      // Laid out like topology.neighbours
+      std::vector <PointWeight> weights;
+
+      std::vector <Vector> normals;
+      std::vector <Vector> next_normals;
+
+      SmoothingData(const SurfaceTopology& topology, const OffsetOptions& options) : topology(topology), options(options) {};
+
+      Span<const PointWeight> point_weights(size_t i) const {
+        size_t begin = topology.neighbour_offsets[i];
+        return Span<const PointWeight>(weights.data() + begin,topology.neighbour_offsets[i+1] - begin);
+      };
+      Span<const Index> point_elements(size_t i) const {
+        size_t begin = topology.corners_begin(i);
+        return Span<const Index>(topology.elements.data() + begin,topology.corners_end(i) - begin);
+      };
+    };
+
+    // Runs pass until the largest change it reports, relative to offset_size, is
+    // within tolerance or max_passes have been run
+    template <typename F>
+    void smooth_until_converged(const char* name, size_t max_passes, double offset_size, double tolerance, F pass) {
+      size_t n_passes = 0;
+      double residual = 0;
+      while (n_passes < max_passes) {
+        residual = pass()/offset_size;
+        n_passes++;
+        if (residual <= tolerance) break;
+      }
+      fprintf(stderr,"%s: %lu passes, residual %g\n",name,n_passes,residual);
+    }
+
+    // Largest distance between matching vectors
+    double max_change(const std::vector <Vector>& a, const std::vector <Vector>& b) {
+      size_t n_chunks = std::max(size_t(1),parallel_chunk_count(a.size()));
+      std::vector <double> chunk_max (n_chunks,0);
+      parallel_chunks_n(a.size(),n_chunks,[&](size_t c, size_t begin, size_t end) {
+        double m = 0;
+        for (size_t i = begin; i < end; ++i)
+          m = std::max(m,(b[i] - a[i]).length());
+        chunk_max[c] = m;
+      });
+      return *std::max_element(chunk_max.begin(),chunk_max.end());
+    }
+
+    std::vector<double> laplace_smooth_down(const SmoothingData& sdata, std::vector <double> data, size_t n, double lambda, bool use_severity) {
+      std::vector<double> correction (data.size());
+      for (size_t j = 0; j < n; ++j) {
+        parallel_for(data.size(),[&](size_t i) {
+          const PointConnection& pc = sdata.connections[i];
+
+          double fac;
+          if (use_severity)
+            fac = pc.geometric_severity;
+          else
+            fac = 1;
+
+          correction[i] = 0;
+          for (const PointWeight& pw : sdata.point_weights(i))
+            correction[i] += fac * lambda * pw.w * (data[pw.p] - data[i]);
+          if (correction[i] > 0)
+            correction[i] = 0;
+        });
+        for (size_t i = 0; i < data.size(); ++i)
+          data[i] += correction[i];
+      }
+      return data;
+    }
+
+    // Points are updated in place, so each pass sees the values already updated
+    // earlier in the same pass. This has to stay serial to give the same result
+    void smooth_minmax_offset_size(SmoothingData& sdata, double offset_size) {
+      std::vector <PointConnection>& connections = sdata.connections;
+      std::vector <double> orig_min_offset_size, orig_max_offset_size;
+      orig_min_offset_size.reserve(connections.size());
+      orig_max_offset_size.reserve(connections.size());
+      for (const PointConnection& pc : connections) {
+        orig_min_offset_size.push_back(pc.min_offset_size);
+        orig_max_offset_size.push_back(pc.max_offset_size);
+      }
+
+      smooth_until_converged("Min/max offset size",100,offset_size,sdata.options.smoothing_tolerance,[&]() {
+        double residual = 0;
+        for (size_t i = 0; i < connections.size(); ++i) {
+          PointConnection& pc = connections[i];
+
+          double lambda = 0.9*pc.geometric_severity;
+
+          double min_adj = 0;
+          double max_adj = 0;
+
+          for (const PointWeight& pw : sdata.point_weights(i)) {
+            const PointConnection& other_pc = connections[pw.p];
+            double delta_min = other_pc.min_offset_size - orig_min_offset_size[i];
+            min_adj += pw.w * delta_min * lambda;
+
+            double delta_max = other_pc.max_offset_size - orig_max_offset_size[i];
+            max_adj += pw.w * delta_max * lambda;
+          }
+          if (min_adj < 0) {
+            double min_offset_size = orig_min_offset_size[i] + min_adj;
+            residual = std::max(residual,fabs(min_offset_size - pc.min_offset_size));
+            pc.min_offset_size = min_offset_size;
+          }
+          if (max_adj > 0) {
+            double max_offset_size = orig_max_offset_size[i] + max_adj;
+            residual = std::max(residual,fabs(max_offset_size - pc.max_offset_size));
+            pc.max_offset_size = max_offset_size;
+          }
+        }
+        return residual;
+      });
+    }
+
+    SmoothingData calculate_point_connections(const Grid& surface, const SurfaceTopology& topology, double offset_size, const OffsetOptions& options) {
+      size_t n_corners = topology.elements.size();
+      std::vector <double> corner_angles (n_corners);
+      std::vector <double> corner_weights (n_corners);
+      std::vector <Vector> corner_bisects (n_corners);
+
+      SmoothingData sdata (topology,options);
+      sdata.connections = std::vector <PointConnection> (surface.points.size());
+      sdata.element_normals = std::vector <Vector> (surface.elements.size());
+      sdata.normals = std::vector <Vector> (surface.points.size());
+      sdata.next_normals = std::vector <Vector> (surface.points.size());
+
+      for (size_t i = 0; i < surface.elements.size(); ++i) {
+        ConstElementRef e = surface.elements[i];
+
+        if (e.type != Shape::Triangle)
+          not_implemented("(tetmesh::calculate_point_connections) Surface must only contain triangles");
+        const Point& p0 = surface.points[e.points[0]];
+        const Point& p1 = surface.points[e.points[1]];
+        const Point& p2 = surface.points[e.points[2]];
+
+        Vector v1 = p1 - p0;
+        Vector v2 = p2 - p1;
+        if (cross(v1,v2).length() == 0)
+          fatal("Bad Element. Has no normal");
+        sdata.element_normals[i] = cross(v1,v2).normalized();
+      }
+
+      sdata.weights.resize(topology.neighbours.size());
+      parallel_for(surface.points.size(),[&](size_t _p) {
+        const Point &p = surface.points[_p];
+        double total_angle = 0;
+        for (size_t c = topology.corners_begin(_p); c < topology.corners_end(_p); ++c) {
+          const Point &pm = surface.points[topology.prev_points[c]];
+          const Point &pp = surface.points[topology.next_points[c]];
+          Vector vm = pm - p;
+          Vector vp = pp - p;
+          double angle = fabs(angle_between(vm,vp));
+          corner_angles[c] = angle;
+          total_angle += angle;
+          corner_bisects[c] = (vm + vp).normalized();
+          if (options.use_tangents)
+            corner_weights[c] = tan(angle/2.0/180*M_PI);
+          else
+            corner_weights[c] = angle;
+        }
+        if (total_angle > 0) {
+          for (size_t c = topology.corners_begin(_p); c < topology.corners_end(_p); ++c)
+            corner_angles[c] /= total_angle;
+        }
+
+        // Each neighbour gets the weights of the two corners on either side of
+        // the edge to it
+        PointWeight* pointweights = sdata.weights.data() + topology.neighbour_offsets[_p];
+        size_t n_neighbours = topology.neighbour_offsets[_p+1] - topology.neighbour_offsets[_p];
+        for (size_t j = 0; j < n_neighbours; ++j)
+          pointweights[j] = PointWeight(topology.neighbours[topology.neighbour_offsets[_p] + j],0);
+        for (size_t c = topology.corners_begin(_p); c < topology.corners_end(_p); ++c) {
+          sdata.weights[topology.prev_slots[c]].w += corner_weights[c];
+          sdata.weights[topology.next_slots[c]].w += corner_weights[c];
+        }
+
+        double total_weight = 0;
+        for (size_t j = 0; j < n_neighbours; ++j) {
+          PointWeight& pw = pointweights[j];
+          const Point& p1 = surface.points[pw.p];
+          Vector d = p1 - p;
+          if (d.length()== 0)
+            fatal("Coincedent points found");
+          double w;
+          if (!options.use_angle)
+            w = 1;
+          else if (options.use_sqrt_angle)
+            w = sqrt(pw.w);
+          else
+            w = pw.w;
+
+          if (options.use_inverse_angle) {
+            if (options.use_tangents) {
+              if (w < tan(M_PI/180))
+                w = 1/tan(M_PI/180);
+              else
+                w = 1/w;
+            } else {
+              if (w < 1)
+                w = 1;
+              else
+                w = 1/w;
+            }
+          }
+
+          if (options.use_length) {
+            double f;
+            if (options.use_sqrt_length)
+              f = sqrt(d.length());
+            else
+              f = d.length();
+
+            if (options.use_inverse_length)
+              w *= f;
+            else
+              w /= f;
+          }
+
+          total_weight += w;
+          pw.w = w;
+        }
+        if (n_neighbours > 0 && total_weight== 0)
+          fatal("Weights sum to zero");
+        for (size_t j = 0; j < n_neighbours; ++j)
+          pointweights[j].w /= total_weight;
+      });
+
+      for (size_t i = 0; i < surface.points.size(); ++i) {
+        PointConnection& pc = sdata.connections[i];
+
+        pc.max_skew_angle = options.max_skew_angle;
+        pc.current_adjustment = 1;
+
+        const Point& p = surface.points[i];
+        Span<const Index> elements = sdata.point_elements(i);
+        size_t first_corner = topology.corners_begin(i);
+
+        Vector point_norm { 0, 0, 0 };
+        Vector point_bisect { 0, 0, 0 };
+        for (size_t j = 0; j < elements.size(); ++j) {
+          size_t _e = elements[j];
+          double fac = corner_angles[first_corner + j];
+
+          const Vector& n = sdata.element_normals[_e];
+          point_norm += fac*n;
+
+          const Vector& bisect = corner_bisects[first_corner + j];
+          point_bisect += fac*bisect;
+        }
+        double norm_length = point_norm.length();
+        if (point_norm.length() == 0)
+          fatal("Point Normal length == 0");
+
+        double convex_test = dot(point_norm.normalized(),point_bisect.normalized());
+        pc.convex = convex_test < 0;
+
+        // Correct normals that will cause self intersections
+        for (size_t j = 0; j < 100; ++j) {
+          bool all_positive = true;
+          for (size_t _e : elements) {
+            const Vector& n = sdata.element_normals[_e];
+            double d = dot(point_norm,n);
+            if (d <= 0) {
+              all_positive = false;
+              point_norm -= 2*d*n;
+            }
+          }
+          if (all_positive) break;
+        }
+        bool bad_vector = false;
+        for (size_t _e : elements) {
+          const Vector& n = sdata.element_normals[_e];
+          double d = dot(point_norm,n);
+          if (d <= 0) {
+            fprintf(stderr,"Can't create normal for ");
+            dump(p);
+            //fatal ("Can't find normal");
+            bad_vector = true;
+            point_norm *= 0;
+            break;
+          }
+        }
+        if (bad_vector) {
+          sdata.normals[i] = Vector { 0, 0, 0 };
+          pc.orig_normal = Vector { 0, 0, 0 };
+          continue;
+        }
+
+        if (point_norm.length() == 0)
+          fatal("Adjusted Point Normal length == 0");
+        point_norm = norm_length*point_norm.normalized();
+
+        assert(norm_length < 1 + sqrt(DBL_EPSILON));
+        pc.geometric_severity = norm_length;
+        if (pc.convex) {
+          pc.geometric_stretch_factor = pc.geometric_severity;
+          pc.min_offset_size = offset_size*pc.geometric_severity;
+          pc.max_offset_size = offset_size*2;
+        } else {
+          pc.geometric_stretch_factor = 1/pc.geometric_severity;
+          pc.min_offset_size = offset_size;
+          pc.max_offset_size = offset_size/pc.geometric_severity*2;
+        }
+
+        sdata.normals[i] = point_norm.normalized()*(offset_size*pc.geometric_stretch_factor);
+        pc.orig_normal = sdata.normals[i];
+      }
+
+      smooth_minmax_offset_size(sdata,offset_size);
+      return sdata;
+    }
+
+    double smooth_normals(const Grid& surface, SmoothingData& data) {
+      parallel_for(surface.points.size(),[&](size_t i) {
+        const Point& surface_p = surface.points[i];
+        const PointConnection& pc = data.connections[i];
+        Vector& smoothed = data.next_normals[i];
+
+        const Vector& curr_normal = data.normals[i];
+        smoothed = curr_normal;
+        const Vector& orig_normal = pc.orig_normal;
+
+        if (orig_normal.length() == 0) return;
+
+        double lambda = data.options.max_lambda*pc.geometric_severity;
+
+        Vector smoothed_normal (curr_normal);
+        for (const PointWeight& pw : data.point_weights(i)) {
+          const Vector& n = data.normals[pw.p];
+          double w = pw.w * lambda;
+          Vector delta = n - curr_normal;
+          smoothed_normal += w * delta;
+        }
+
+        double perp_length = dot(orig_normal.normalized(),smoothed_normal);
+
+        Vector smoothed_perp = perp_length * orig_normal.normalized();
+        Vector smoothed_lateral = smoothed_normal - smoothed_perp;
+
+        double lat_length = smoothed_lateral.length();
+        perp_length = smoothed_perp.length();
+
+        const double max_normal_skew_factor = tan(data.options.max_normals_skew_angle*pc.geometric_severity/180.0*M_PI);
+        if (data.options.use_skew_restriction && lat_length > 0 && lat_length > max_normal_skew_factor*perp_length)
+          smoothed_lateral *= max_normal_skew_factor*perp_length/lat_length;
+
+        smoothed_normal = smoothed_lateral + smoothed_perp;
+
+        smoothed = smoothed_normal.normalized()*orig_normal.length();
+        for (Index _e : data.point_elements(i)) {
+          const Vector& n = data.element_normals[_e];
+          if (dot(smoothed,n) <= 0) {
+            // Use old normal if self intersections created
+            smoothed = curr_normal;
+            break;
+          }
+        }
+      });
+      data.normals.swap(data.next_normals);
+      return max_change(data.normals,data.next_normals);
+    }
+
+    // Writes the smoothed normal of point i to next_normals
+    void smooth_point_connection(const Grid& surface, SmoothingData& data, size_t i) {
+      const Point& surface_p = surface.points[i];
+      const PointConnection& pc = data.connections[i];
+      Vector& smoothed = data.next_normals[i];
+
+      const Vector& curr_normal = data.normals[i];
+      smoothed = curr_normal;
+      const Vector& orig_normal = pc.orig_normal;
+      const double max_normal_skew_factor = tan(pc.max_skew_angle*pc.geometric_severity/180.0*M_PI);
+
+      if (orig_normal.length() == 0) return;
+
+      double lambda = data.options.max_lambda*pc.geometric_severity;
+      Point orig_p;
+      if (data.options.use_original_offset)
+        orig_p = surface_p + orig_normal;
+      else
+        orig_p = surface_p + curr_normal;
+
+      Point smoothed_point (orig_p);
+      for (const PointWeight& pw : data.point_weights(i)) {
+        const Point& p = surface.points[pw.p];
+        const Vector& n = data.normals[pw.p];
+        double w = pw.w * lambda;
+        Point offset_p = p+n;
+        Vector delta = offset_p - orig_p;
+        smoothed_point += w * delta;
+      }
+      Vector smoothed_normal = smoothed_point - surface_p;
+
+      assert (orig_normal.length() > 0);
+
+      double perp_length = dot(orig_normal.normalized(),smoothed_normal);
+
+      Vector smoothed_perp = perp_length * orig_normal.normalized();
+      Vector smoothed_lateral = smoothed_normal - smoothed_perp;
+
+      if (perp_length < pc.min_offset_size*pc.current_adjustment) smoothed_perp *= pc.min_offset_size*pc.current_adjustment/perp_length;
+      else if (perp_length > pc.max_offset_size) smoothed_perp *= pc.max_offset_size/perp_length;
+
+      double lat_length = smoothed_lateral.length();
+      perp_length = smoothed_perp.length();
+      if (data.options.use_skew_restriction && lat_length > 0 && lat_length > max_normal_skew_factor*perp_length)
+        smoothed_lateral *= max_normal_skew_factor*perp_length/lat_length;
+      smoothed = smoothed_lateral + smoothed_perp;
+
+      // Check for creation of self intersection elements
+      for (Index _e : data.point_elements(i)) {
+        const Vector& n = data.element_normals[_e];
+        if (dot(smoothed,n) <= 0) {
+          // Use old normal if self intersections created
+          smoothed = curr_normal;
+          break;
+        }
+      }
+    }
+
+    double smooth_point_connections(const Grid& surface, SmoothingData& data) {
+      parallel_for(surface.points.size(),[&](size_t i) { smooth_point_connection(surface,data,i); });
+      data.normals.swap(data.next_normals);
+      return max_change(data.normals,data.next_normals);
+    }
+
+    // Repair smoothing only visits the points whose result can change. A pass
+    // can only move a point if the point or one of its neighbours moved in the
+    // pass before, so each pass smooths the points that moved by more than
+    // repair_tolerance in the last pass and their neighbours. Points that
+    // settle drop out, and the rest of the surface is left as it is. The list
+    // is kept between iterations, so points still settling from one repair
+    // carry on into the next
+    struct RepairWorklist {
+      std::vector <Index> moved;
+      std::vector <Index> active;
+      std::vector <bool> in_active;
+      std::vector <bool> is_repaired;
+      std::vector <Index> repaired; // Points smoothed since start_repair
+
+      // Every point starts on the list, since the smoothing before the repairs
+      // may not have settled
+      RepairWorklist(size_t n_points) : moved(n_points), in_active(n_points,false), is_repaired(n_points,false) {
+        for (size_t i = 0; i < n_points; ++i)
+          moved[i] = i;
+      };
+
+      void add(Index i) { moved.push_back(i); };
+
+      void start_repair() {
+        for (Index i : repaired)
+          is_repaired[i] = false;
+        repaired.clear();
+      };
+
+      // One pass over the points that can change. Returns the largest change
+      double smooth(const Grid& surface, SmoothingData& data, double tolerance) {
+        active.clear();
+        auto activate = [&](Index i) {
+          if (in_active[i]) return;
+          in_active[i] = true;
+          active.push_back(i);
+        };
+        for (Index i : moved) {
+          activate(i);
+          for (const PointWeight& pw : data.point_weights(i))
+            activate(pw.p);
+        }
+        for (Index i : active) {
+          in_active[i] = false;
+          if (!is_repaired[i]) {
+            is_repaired[i] = true;
+            repaired.push_back(i);
+          }
+        }
+
+        parallel_for(active.size(),[&](size_t j) { smooth_point_connection(surface,data,active[j]); });
+        double residual = 0;
+        moved.clear();
+        for (Index i : active) {
+          double change = (data.next_normals[i] - data.normals[i]).length();
+          residual = std::max(residual,change);
+          if (change > tolerance)
+            moved.push_back(i);
+          data.normals[i] = data.next_normals[i];
+        }
+        return residual;
+      };
+    };
+
+    double smooth_point_connections_taubin(const Grid& surface, SmoothingData& data, double gamma) {
+      parallel_for(surface.points.size(),[&](size_t i) {
+        const Point& surface_p = surface.points[i];
+        const PointConnection& pc = data.connections[i];
+        Vector& smoothed = data.next_normals[i];
+
+        const Vector& curr_normal = data.normals[i];
+        smoothed = curr_normal;
+        const Vector& orig_normal = pc.orig_normal*pc.current_adjustment;
+        const double max_normal_skew_factor = tan(pc.max_skew_angle*pc.geometric_severity/180.0*M_PI);
+
+        if (orig_normal.length() == 0) return;
+
+        Point orig_p;
+        if (data.options.use_original_offset)
+          orig_p = surface_p + orig_normal;
+        else
+          orig_p = surface_p + curr_normal;
+
+        Point smoothed_point (orig_p);
+        for (const PointWeight& pw : data.point_weights(i)) {
+          const Point& p = surface.points[pw.p];
+          const Vector& n = data.normals[pw.p];
+          double w = pw.w * gamma;
+          Point offset_p = p + n;
+          Vector delta = offset_p - orig_p;
+          smoothed_point += w * delta;
+        }
+        Vector smoothed_normal = smoothed_point - surface_p;
+        if (gamma > 0) {
+          smoothed = smoothed_normal;
+        } else {
+          double perp_length = dot(orig_normal.normalized(),smoothed_normal);
+          assert (perp_length > 0);
+
+          Vector smoothed_perp = perp_length * orig_normal.normalized();
+          Vector smoothed_lateral = smoothed_normal - smoothed_perp;
+
+          if (perp_length < pc.min_offset_size) smoothed_perp *= pc.min_offset_size/perp_length;
+          else if (perp_length > pc.max_offset_size) smoothed_perp *= pc.max_offset_size/perp_length;
+
+          double lat_length = smoothed_lateral.length();
+          perp_length = smoothed_perp.length();
+          if (data.options.use_skew_restriction && lat_length > 0 && lat_length > max_normal_skew_factor*perp_length)
+            smoothed_lateral *= max_normal_skew_factor*perp_length/lat_length;
+          smoothed = smoothed_lateral + smoothed_perp;
+
+          // Check for creation of self intersection elements
+          for (Index _e : data.point_elements(i)) {
+            const Vector& n = data.element_normals[_e];
+            if (dot(smoothed,n) <= 0) {
+              // Use old normal if self intersections created
+              smoothed = curr_normal;
+              break;
+            }
+          }
+        }
+      });
+      data.normals.swap(data.next_normals);
+      return max_change(data.normals,data.next_normals);
+    }
+
+    Grid offset_surface_with_point_connections(const Grid& surface, const std::vector <Vector>& normals) {
+      Grid offset (3);
+      offset.elements = surface.elements;
+      offset.names = surface.names;
+      offset.points = surface.points;
+      for (size_t i = 0; i < surface.points.size(); ++i)
+        offset.points[i] += normals[i];
+      return offset;
+    }
+
+    void write_grid_with_data (std::string filename, const Grid& surface, const SmoothingData& smoothing_data) {
+      std::vector <Vector> orig_normals, normals;
+      std::vector <double> geometric_severity, min_offset_size, max_offset_size;
+
+      size_t n_points = surface.points.size();
+
+      orig_normals.reserve(n_points);
+      normals.reserve(n_points);
+      geometric_severity.reserve(n_points);
+      min_offset_size.reserve(n_points);
+      max_offset_size.reserve(n_points);
+
+      for (size_t i = 0; i < n_points; ++i) {
+        const PointConnection& pc = smoothing_data.connections[i];
+        orig_normals.push_back(pc.orig_normal);
+        normals.push_back(smoothing_data.normals[i]);
+        geometric_severity.push_back(pc.geometric_severity);
+        min_offset_size.push_back(pc.min_offset_size);
+        max_offset_size.push_back(pc.max_offset_size);
+      }
+
+      write_grid(filename,surface);
+      vtk_write_point_data_header(filename,surface);
+      vtk_write_data(filename,"orig_normals",orig_normals);
+      vtk_write_data(filename,"normals",normals);
+      vtk_write_data(filename,"geometric_severity",geometric_severity);
+      vtk_write_data(filename,"min_offset_size",min_offset_size);
+      vtk_write_data(filename,"max_offset_size",max_offset_size);
+    }
+
+    void fix_offset_skew ( const Grid& surface, Grid& offset ) {
+      std::vector <Vector> surface_normals (surface.elements.size());
+      for (size_t _e = 0; _e < surface.elements.size(); ++_e) {
+        ConstElementRef e = surface.elements[_e];
+        if (e.type != Shape::Triangle) fatal();
+
+        const Point& p0 = surface.points[e.points[0]];
+        const Point& p1 = surface.points[e.points[1]];
+        const Point& p2 = surface.points[e.points[2]];
+
+        surface_normals[_e] = cross(p1 - p0, p2 - p1).normalized();
+      }
+      size_t total_fixed = 0;
+      size_t fixed = 1;
+      while (fixed > 0) {
+        fixed = 0;
+        for (size_t _e = 0; _e < surface.elements.size(); ++_e) {
+          const Vector& surface_normal = surface_normals[_e];
+
+          ConstElementRef e = offset.elements[_e];
+          const Point& p0 = offset.points[e.points[0]];
+          const Point& p1 = offset.points[e.points[1]];
+          const Point& p2 = offset.points[e.points[2]];
+
+          Vector offset_normal = cross(p1 - p0, p2 - p1).normalized();
+
+          if (dot(offset_normal,surface_normal) < 0.5) {
+            ConstElementRef se = surface.elements[_e];
+            const Point& sp0 = surface.points[e.points[0]];
+            const Point& sp1 = surface.points[e.points[1]];
+            const Point& sp2 = surface.points[e.points[2]];
+
+            Point surface_center = (sp0 + sp1 + sp2)/3;
+
+            double min_off = DBL_MAX;
+            for (size_t i = 0; i < 3; ++i) {
+              const Point& sp = surface.points[e.points[i]];
+              const Point& op = offset.points[e.points[i]];
+              double off;
+              if (sp == op) {
+                off = 0;
+              } else {
+                Vector n = (op - sp);
+                double off = dot(n,surface_normal);
+              }
+              if (off < min_off)
+                min_off = off;
+            }
+            if (min_off < 0) fatal("Shouldn't be possible");
+            for (size_t i = 0; i < 3; ++i) {
+              const Point& sp = surface.points[e.points[i]];
+              const Point& op = offset.points[e.points[i]];
+              Vector n = (op - sp);
+              double off = dot(n,surface_normal);
+              if (off > 1.5*min_off) {
+                fixed++;
+                dump(offset.elements[_e],offset);
+                if (min_off == 0) {
+                  offset.points[e.points[i]] = sp;
+                } else {
+                  double ratio = min_off/off + DBL_EPSILON;
+                  offset.points[e.points[i]] = sp + ratio*n;
+                }
+              }
+            }
+          }
+        }
+        if (fixed > 0)
+          printf("%d Fixed Points due to skew\n",fixed);
+        total_fixed += fixed;
+      }
+      if (total_fixed > 0)
+        printf("%d Total Fixed Points due to skew\n",total_fixed);
+    }
+
+    Grid create_offset_surface (const Grid& surface, const SurfaceTopology& topology, double offset_size, const OffsetOptions& options, const std::string& filename) {
+
+      SmoothingData smoothing_data = calculate_point_connections(surface,topology,offset_size,options);
+
+      Grid presmooth = offset_surface_with_point_connections(surface,smoothing_data.normals);
+      if (options.write_intermediate)
+        write_grid(filename+".presmooth.stl",presmooth);
+
+      if (options.use_future_intersections) {
+        fprintf(stderr,"Checking for future intersections\n");
+        Grid offset = offset_surface_with_point_connections(surface,smoothing_data.normals);
+        PointPairList intersections = Intersections::find_future(surface,offset);
+        if (intersections.size()) {
+          fprintf(stderr,"%lu Normals scaled due to future intersections\n",intersections.size());
+          std::vector <double> scale_factors (surface.points.size(),1);
+          for (const PointPair& pp : intersections) {
+            Index _p1 = pp.first;
+            Index _p2 = pp.second;
+
+            const Point& p1 = surface.points[_p1];
+            const Point& p2 = surface.points[_p2];
+
+            double d = (p2 - p1).length();
+            double s = Intersections::get_scale_factor(d);
+
+            scale_factors[_p1] = s;
+          }
+          scale_factors = laplace_smooth_down(smoothing_data, scale_factors, 10, 1.0, true);
+          for (size_t i = 0; i < surface.points.size(); ++i) {
+            PointConnection& pc = smoothing_data.connections[i];
+            double s = scale_factors[i];
+            if (s < 0.2)
+              s = 0;
+            smoothing_data.normals[i] *= s;
+            pc.orig_normal *= s;
+            pc.min_offset_size *= s;
+            pc.max_offset_size *= s;
+          }
+        }
+      }
+
+      smooth_until_converged("Normal smoothing",10,offset_size,options.smoothing_tolerance,[&]() {
+        return smooth_normals(surface,smoothing_data);
+      });
+      if (options.write_intermediate)
+        write_grid_with_data(filename+".data.vtk",surface,smoothing_data);
+      for (size_t i = 0; i < surface.points.size(); ++i)
+        smoothing_data.connections[i].orig_normal = smoothing_data.normals[i];
+
+      if (options.use_taubin) {
+        const double kpb = options.taubin_pass_band;
+        const double gamma = (kpb - 3)/(3*kpb - 5);
+        const double mu = 1/(kpb - 1/gamma);
+
+        // The two halves of a step move points in opposite directions, so
+        // convergence is judged on the change over the whole step
+        std::vector <Vector> step_start;
+        smooth_until_converged("Taubin smoothing",options.taubin_steps,offset_size,options.smoothing_tolerance,[&]() {
+          step_start = smoothing_data.normals;
+          smooth_point_connections_taubin(surface,smoothing_data,gamma);
+          smooth_point_connections_taubin(surface,smoothing_data,mu);
+          return max_change(step_start,smoothing_data.normals);
+        });
+      } else {
+        smooth_until_converged("Offset smoothing",100,offset_size,options.smoothing_tolerance,[&]() {
+          return smooth_point_connections(surface,smoothing_data);
+        });
+      }
+
+      if (options.write_intermediate)
+        write_grid_with_data(filename+".data2.vtk",surface,smoothing_data);
+      Grid offset = offset_surface_with_point_connections(surface,smoothing_data.normals);
+      if (options.write_intermediate)
+        write_grid(filename+".smoothed.stl",offset);
+
+      Grid offset_volume = volume_from_surfaces(surface,offset);
+
+      size_t n_surface_points = surface.points.size();
+      size_t last_n_intersected = INT_MAX;
+      size_t last_n_negative = INT_MAX;
+      bool needs_radical_improvement = false;
+      size_t failed_steps = 0;
+      bool successful;
+      IntersectionTracker tracker (offset_volume);
+      NegativeVolumeTracker volume_tracker (offset_volume);
+      RepairWorklist worklist (n_surface_points);
+      for (size_t i = 1; i < 1000; ++i) {
+        successful = true;
+        std::vector <Index> negative_volumes = volume_tracker.update(offset_volume);
+
+        if (negative_volumes.size() > 0) {
+          fprintf(stderr,"%lu Negative Volumes\n",negative_volumes.size());
+          successful = false;
+        }
+
+        fprintf(stderr,"Checking for Intersections\n");
+        Intersections intersections = tracker.update(offset_volume);
+        if (i > 1)
+          fprintf(stderr,"%lu Points Moved\n",tracker.n_moved_points);
+
+        if (intersections.elements.size() > 0) {
+          fprintf(stderr,"%lu Intersected Elements\n",intersections.elements.size());
+          successful = false;
+        }
+
+        if (successful) break;
+
+        if (!needs_radical_improvement) {
+          if (intersections.elements.size() >= last_n_intersected && negative_volumes.size() >= last_n_negative) {
+            failed_steps++;
+            fprintf(stderr,"Failed iteration\n");
+            if (failed_steps > 1) {
+              needs_radical_improvement = true;
+              fprintf(stderr,"Switching to radical measures\n");
+            }
+          } else
+            failed_steps = 0;
+          last_n_intersected = intersections.elements.size();
+          last_n_negative = negative_volumes.size();
+        }
+
+        printf("Iteration %d\n",i);
+        std::vector <bool> poisoned_points (offset_volume.points.size(),false);
+
+        for (size_t _e : negative_volumes) {
+          ElementRef e = offset_volume.elements[_e];
+          for (size_t p : e.points)
+            poisoned_points[p] = true;
+        }
+
+        for (size_t _p : intersections.points)
+          poisoned_points[_p] = true;
+
+        for (ElementRef e : offset_volume.elements) {
+          assert (e.points.size() == 6);
+          for (size_t j = 3; j < 6; ++j) {
+            size_t _p0 = e.points[j-3];
+            size_t _p = e.points[j];
+            if (poisoned_points[_p]) {
+              PointConnection& pc = smoothing_data.connections[_p-n_surface_points];
+              if (needs_radical_improvement) {
+                pc.current_adjustment = 0;
+                pc.orig_normal *= 0;
+                smoothing_data.normals[_p-n_surface_points] *= 0;
+              } else {
+                pc.current_adjustment *= 0.9;
+                if (pc.current_adjustment < 0.6)
+                  pc.current_adjustment = 0.6;
+                pc.max_skew_angle = options.max_relaxed_skew_angle;
+              }
+              poisoned_points[_p] = false;
+              worklist.add(_p-n_surface_points);
+            }
+          }
+        }
+        if (options.use_global_repair) {
+          smooth_until_converged("Repair smoothing",20,offset_size,options.smoothing_tolerance,[&]() {
+            return smooth_point_connections(surface,smoothing_data);
+          });
+
+          Grid offset = offset_surface_with_point_connections(surface,smoothing_data.normals);
+
+          for (size_t j = 0; j < n_surface_points; ++j)
+            offset_volume.points[j+n_surface_points] = offset.points[j];
+        } else {
+          worklist.start_repair();
+          smooth_until_converged("Repair smoothing",20,offset_size,options.smoothing_tolerance,[&]() {
+            return worklist.smooth(surface,smoothing_data,options.repair_tolerance*offset_size);
+          });
+          fprintf(stderr,"%lu Points Repaired\n",worklist.repaired.size());
+
+          for (Index j : worklist.repaired)
+            offset_volume.points[j+n_surface_points] = surface.points[j] + smoothing_data.normals[j];
+        }
+      }
+
+      if (!successful) {
+        std::vector <Index> negative_volumes = find_negative_volumes(offset_volume);
+        if (negative_volumes.size() > 0) {
+          printf("%lu Negative Volumes\n",negative_volumes.size());
+          fatal("Still Negative Volumes");
+        }
+
+        fprintf(stderr,"Checking for Intersections");
+        Intersections intersections = Intersections::find(offset_volume);
+        if (intersections.elements.size() > 0) {
+          fprintf(stderr,"%lu Intersected Points\n",intersections.elements.size());
+          fatal("Still Intersections");
+        }
+      }
+
+      for (size_t i = 0; i < n_surface_points; ++i)
+        offset.points[i] = offset_volume.points[i+n_surface_points];
+
+      if (options.use_offset_skew_fix)
+        fix_offset_skew(surface,offset);
+      return offset;
+    }
+
+  }
+
+  OffsetLayers create_offset_layers(const Grid& surface, const OffsetOptions& options) {
+    OffsetLayers layers;
+    if (options.offset_size == 0 || options.n_layers == 0) {
+      layers.volume.points = surface.points;
+      layers.outer_surface = surface;
+      layers.top.resize(surface.points.size());
+      for (size_t i = 0; i < layers.top.size(); ++i)
+        layers.top[i] = i;
+      return layers;
+    }
+
+    const std::string& output_filename = options.intermediate_filename;
+    if (options.write_intermediate)
+      write_grid(output_filename+".0.offset.stl",surface);
+
+    PrismStack stack (surface);
+    Grid offset_surface (3);
+    Grid last_offset_surface (surface);
+    SurfaceTopology topology (surface);
+    double current_offset_size = options.offset_size;
+    for (size_t i = 0; i < options.n_layers; ++i) {
+      std::ostringstream f;
+      f << output_filename << "." << i+1;
+      std::string filename (f.str());
+      printf("Creating Layer %d\n",i+1);
+
+      offset_surface = create_offset_surface(last_offset_surface,topology,current_offset_size,options,filename);
+
+      if (options.write_intermediate)
+        write_grid(filename+".offset.stl",offset_surface);
+
+      stack.add_layer(offset_surface);
+
+      current_offset_size *= options.growth_rate;
+      last_offset_surface = offset_surface;
+    }
+    stack.volume.collapse_elements(false);
+
+    layers.volume = std::move(stack.volume);
+    layers.outer_surface = std::move(offset_surface);
+    layers.top = std::move(stack.top);
+    return layers;
+  }
+
+  Grid create_farfield_mesh(const Grid& surface, const OffsetLayers& layers, const std::vector <Point>& holes, const OffsetOptions& options) {
+    printf("Creating Farfield Mesh\n");
+    const Grid& outer_surface = layers.outer_surface;
+    Grid farfield_surface = create_farfield_box(outer_surface);
+    Grid volume = volgrid_from_surface(outer_surface+farfield_surface,holes,options.tetgen_min_ratio);
+    if (options.write_intermediate)
+      write_grid(options.intermediate_filename+".farfield_volume.vtk",volume);
+    check_farfield_points(volume,outer_surface,farfield_surface);
+
+    // The top layer is shared with the farfield volume
+    const Grid& offset_volume = layers.volume;
+    std::vector <Index> offset_map (offset_volume.points.size(),max_index);
+    for (size_t i = 0; i < layers.top.size(); ++i)
+      offset_map[layers.top[i]] = i;
+    for (size_t i = 0; i < offset_map.size(); ++i) {
+      if (offset_map[i] == max_index) {
+        offset_map[i] = volume.points.size();
+        volume.points.push_back(offset_volume.points[i]);
+      }
+    }
+    std::vector <Index> farfield_map (farfield_surface.points.size());
+    for (size_t i = 0; i < farfield_map.size(); ++i)
+      farfield_map[i] = outer_surface.points.size() + i;
+
+    if (offset_volume.elements.size() > 0)
+      append_mapped(volume,offset_volume,offset_map);
+    append_mapped(volume,farfield_surface,farfield_map);
+    append_mapped(volume,surface,offset_map);
+    return volume;
+  }
+
+} //namespace tetmesh
@@ -6,7 +6,6 @@
 #include <tetgen.h>
 
 #include <algorithm>
-#include <list>
 #include <algorithm>
 #include <vector>
 #include <utility>
@@ -25,14 +24,12 @@ namespace tetmesh {
       p.z = tg.pointlist[3*i+2];
       grid.points.push_back(p);
     }
-    grid.elements.reserve(tg.numberoftrifaces);
+    grid.elements.reserve(tg.numberoftrifaces,3*tg.numberoftrifaces);
     for (int i = 0; i < tg.numberoftrifaces; ++i) {
-      Element e (Shape::Triangle);
-      e.name_i = tg.trifacemarkerlist[i];
+      ElementRef e = grid.elements.emplace_back(Shape::Triangle,tg.trifacemarkerlist[i]);
       e.points[0] = tg.trifacelist[3*i];
       e.points[1] = tg.trifacelist[3*i+1];
       e.points[2] = tg.trifacelist[3*i+2];
-      grid.elements.push_back(e);
     }
     grid.names[0].dim = 2;
     return grid;
@@ -58,7 +55,7 @@ namespace tetmesh {
     in.facetmarkerlist = new int[in.numberoffacets];
 
     for (size_t i = 0; i < surface.elements.size(); ++i) {
-      Element const& e = surface.elements[i];
+      ConstElementRef e = surface.elements[i];
       tetgenio::facet& f = in.facetlist[i];
       tetgenio::init(&f);
 
@@ -95,172 +92,60 @@ namespace tetmesh {
     return surfacegrid_from_tetgenio(out);
   }
 
-  struct Edge {
-    std::pair <size_t,size_t> points;
-    std::pair <size_t,size_t> elements;
-    Edge() {};
-    Edge(size_t p1, size_t p2, size_t element1, size_t element2) : points(p1,p2), elements(element1,element2) {};
-    bool operator<(const Edge& other) const { return points < other.points; };
-  };
-
-  struct PartialEdge {
-    std::pair <size_t,size_t> points;
-    size_t element;
-    PartialEdge() {};
-    PartialEdge(size_t p1, size_t p2, size_t element) : points(p1,p2), element(element) {};
-    bool operator<(const PartialEdge& other) const { return points < other.points; };
-  };
-
-  void verify_complete_surfaces(const Grid& surface) {
-    std::vector < PartialEdge > edges;
-    std::vector < std::vector<PartialEdge> > edges_per_point (surface.points.size());
-    for (size_t i = 0; i < surface.elements.size(); ++i) {
-      const Element& e = surface.elements[i];
-      if (Shape::Info[e.type].dim != 2)
-        fatal("Not a surface. Has non-surface elements");
-      for (size_t j = 0; j < e.points.size(); ++j) {
-        size_t j2 = (j + 1)%e.points.size();
-        size_t p = e.points[j];
-        size_t p2 = e.points[j2];
-        if (p < p2) {
-          edges.push_back( PartialEdge(p,p2,i) );
-          edges_per_point[p].push_back( PartialEdge(p,p2,i) );
-          edges_per_point[p2].push_back( PartialEdge(p,p2,i) );
-        } else {
-          edges.push_back( PartialEdge(p2,p,i) );
-          edges_per_point[p].push_back( PartialEdge(p2,p,i) );
-          edges_per_point[p2].push_back( PartialEdge(p2,p,i) );
-        }
-      }
-    }
-    std::sort(edges.begin(),edges.end());
-    for (size_t i = 0; i < edges.size(); i+=2) {
-      if (i == edges.size()-1)
-        fatal("Boundary Edge found (1)");
-      size_t i2 = i + 1;
-      if (edges[i].points != edges[i2].points)
-        fatal("Boundary Edge found (2)");
-      if (i + 2 < edges.size()) {
-        size_t i3 = i + 2;
-        if (edges[i2].points == edges[i3].points)
-          fatal("Non-Manifold Edge Found");
-      }
-    }
-    for (std::vector <PartialEdge> edges : edges_per_point) {
-      if (edges.size()%2 != 0)
-        fatal("Boundary Edge found (3)");
-      std::sort(edges.begin(),edges.end());
-      std::list <Edge> edge_list;
-      for (size_t i = 0; i < edges.size()/2; ++i) {
-        const PartialEdge& ee1 = edges[2*i];
-        const PartialEdge& ee2 = edges[2*i+1];
-        if (ee1.points != ee2.points)
-          fatal("Boundary Edge found (4)");
-        edge_list.push_back( Edge(ee1.points.first,ee1.points.second,ee1.element,ee2.element) );
-      }
-      std::list <size_t> surface_list;
-      size_t initial_size = edge_list.size();
-      for (size_t i = 0; i < initial_size; ++i) {
-        if (edge_list.size() == 0) break;
-        auto it = edge_list.begin();
-        while (it != edge_list.end()) {
-          Edge& ee = *it;
-          if (surface_list.size() == 0) {
-            surface_list.push_back(ee.elements.first);
-            surface_list.push_back(ee.elements.second);
-            it = edge_list.erase(it);
-          } else if (ee.elements.first == surface_list.front()) {
-            surface_list.push_front(ee.elements.second);
-            it = edge_list.erase(it);
-          } else if (ee.elements.second == surface_list.front()) {
-            surface_list.push_front(ee.elements.first);
-            it = edge_list.erase(it);
-          } else if (ee.elements.first == surface_list.back()) {
-            surface_list.push_back(ee.elements.second);
-            it = edge_list.erase(it);
-          } else if (ee.elements.second == surface_list.back()) {
-            surface_list.push_back(ee.elements.first);
-            it = edge_list.erase(it);
-          } else {
-            it++;
-          }
-        }
-      }
-      if (surface_list.front() != surface_list.back())
-        fatal("Boundary Edge Found (5)");
-      if (edge_list.size() > 0)
+  void verify_complete_surfaces(const Grid& surface, const HalfEdgeSurface& half_edges) {
+    if (half_edges.boundary_half_edges.size())
+      fatal("Boundary Edge found");
+    if (half_edges.nonmanifold_half_edges.size())
+      fatal("Non-Manifold Edge Found");
+    for (size_t p = 0; p < surface.points.size(); ++p) {
+      if (half_edges.fan_size(p) != half_edges.n_point_half_edges(p))
         fatal("Non-manifold Point Found");
     }
   }
 
   std::vector <Point> orient_surfaces(Grid& surface) {
-    verify_complete_surfaces(surface);
+    HalfEdgeSurface half_edges (surface);
+    verify_complete_surfaces(surface,half_edges);
 
     Intersections intersections = Intersections::find(surface);
     if (intersections.points.size() || intersections.elements.size()) {
       fatal("Intersections found in surface");
     }
 
-    Grid vol = volgrid_from_surface(surface);
-
-    std::vector< std::vector<bool> > surface_map;
-
-    bool found_point = false;
-    for (const Element& e : surface.elements) {
+    for (ConstElementRef e : surface.elements) {
       if (e.type != Shape::Triangle) fatal("orient_surface only works with triangles currently");
-      bool match = false;
-      for (std::vector<bool>& s : surface_map) {
-        if (s[e.points[0]] || s[e.points[1]] || s[e.points[2]]) {
-          s[e.points[0]] = true;
-          s[e.points[1]] = true;
-          s[e.points[2]] = true;
-          match = true;
-          break;
-        }
-      }
-      if (!match) {
-        std::vector<bool> s ( surface.points.size(), false );
-        s[e.points[0]] = true;
-        s[e.points[1]] = true;
-        s[e.points[2]] = true;
-        surface_map.push_back(s);
-      }
     }
-    size_t n_surfaces = 0;
-    for (size_t i = 0; i < surface_map.size(); ++i) {
-      std::vector<bool>& s1 = surface_map[i];
-      bool deleted = false;
-      for (size_t j = i+1; j < surface_map.size(); ++j) {
-        std::vector<bool>& s2 = surface_map[j];
-        bool match = false;
-        for (size_t k = 0; k < s1.size(); ++k) {
-          if (s1[k] && s2[k]) {
-            match = true;
-            break;
-          }
-        }
-        if (match) {
-          for (size_t k = 0; k < s1.size(); ++k) {
-            if (s1[k]) s2[k] = true;
-          }
-          deleted = true;
-          break;
-        }
-      }
-      if (!deleted) {
-        surface_map[n_surfaces] = surface_map[i];
-        n_surfaces++;
+
+    size_t n_surfaces;
+    std::vector <Index> component = surface.connected_components(n_surfaces);
+    if (n_surfaces > 1)
+      fprintf(stderr,"%lu Surfaces Found\n",n_surfaces);
+
+    std::vector< std::vector<Index> > surface_elements (n_surfaces);
+    for (size_t i = 0; i < surface.elements.size(); ++i)
+      surface_elements[component[i]].push_back(i);
+
+    // Triangles that are flipped relative to the rest of their surface are
+    // turned around first, so the whole surface can be oriented at once
+    std::vector <bool> flip;
+    if (!half_edges.orient(flip))
+      fatal("Surface can't be oriented consistently");
+    for (size_t i = 0; i < surface.elements.size(); ++i) {
+      if (flip[i]) {
+        ElementRef e = surface.elements[i];
+        std::swap(e.points[1],e.points[2]);
       }
     }
-    surface_map.resize(n_surfaces);
-    if (n_surfaces > 1)
-      fprintf(stderr,"%d Surfaces Found\n",n_surfaces);
 
+    // Each surface is tested on its own, so the hole ends up inside the
+    // surface it belongs to even when surfaces are nested
     std::vector <Point> holes;
-    for (const std::vector<bool> s : surface_map) {
+    for (const std::vector<Index>& elements : surface_elements) {
+      InsideTest inside_test (surface,elements);
+
       bool hole_found = false;
-      for (const Element& e : surface.elements) {
-        if (!s[e.points[0]]) continue;
+      for (Index _e : elements) {
+        ConstElementRef e = surface.elements[_e];
         const Point& p0 = surface.points[e.points[0]];
         const Point& p1 = surface.points[e.points[1]];
         const Point& p2 = surface.points[e.points[2]];
@@ -274,16 +159,16 @@ namespace tetmesh {
         Point test = p - n*1e-6;
         Point test2 = p + n*1e-6;
 
-        if (vol.test_point_inside(test)) {
+        if (inside_test.inside(test)) {
           holes.push_back(test);
           hole_found = true;
           break;
-        } else if (vol.test_point_inside(test2)) {
+        } else if (inside_test.inside(test2)) {
 #ifndef NDEBUG
           fprintf(stderr,"(tetmesh::orient_surface) Reorienting Surface\n");
 #endif
-          for (Element& e : surface.elements) {
-            if (!s[e.points[0]]) continue;
+          for (Index _e : elements) {
+            ElementRef e = surface.elements[_e];
             if (e.type != Shape::Triangle)
               fatal("(tetmesh::orient_surface) current only works with triangle surfaces");
             std::swap(e.points[1],e.points[2]);
@@ -18,15 +18,14 @@ namespace tetmesh {
       p.z = tg.pointlist[3*i+2];
       grid.points.push_back(p);
     }
-    grid.elements.reserve(grid.elements.size()+tg.numberoftetrahedra);
+    grid.elements.reserve(grid.elements.size()+tg.numberoftetrahedra,grid.elements.connectivity.size()+4*tg.numberoftetrahedra);
     for (int i = 0; i < tg.numberoftetrahedra; ++i) {
-      Element e (Shape::Tetra);
+      ElementRef e = grid.elements.emplace_back(Shape::Tetra);
       assert (tg.numberofcorners == 4);
       e.points[0] = tg.tetrahedronlist[4*i];
       e.points[1] = tg.tetrahedronlist[4*i+1];
       e.points[2] = tg.tetrahedronlist[4*i+2];
       e.points[3] = tg.tetrahedronlist[4*i+3];
-      grid.elements.push_back(e);
     }
     return grid;
   }
@@ -51,7 +50,7 @@ namespace tetmesh {
     in.facetmarkerlist = new int[in.numberoffacets];
 
     for (size_t i = 0; i < surface.elements.size(); ++i) {
-      Element const& e = surface.elements[i];
+      ConstElementRef e = surface.elements[i];
       tetgenio::facet& f = in.facetlist[i];
       tetgenio::init(&f);
 
@@ -102,9 +101,9 @@ namespace tetmesh {
   }
 
   Point find_point_inside_surface(const Grid& surface) {
-    Grid vol = volgrid_from_surface(surface);
+    InsideTest inside_test (surface);
 
-    const Element& e = surface.elements[0];
+    ConstElementRef e = surface.elements[0];
     assert (e.type == Shape::Triangle);
     const Point& p0 = surface.points[e.points[0]];
     const Point& p1 = surface.points[e.points[1]];
@@ -115,9 +114,9 @@ namespace tetmesh {
     Point test = p0 + n*1e-6;
     Point test2 = p0 - n*1e-6;
 
-    if (vol.test_point_inside(test))
+    if (inside_test.inside(test))
       return test;
-    else if (vol.test_point_inside(test2))
+    else if (inside_test.inside(test2))
       return test2;
     else
       fatal("Not sure what to do");
@@ -126,10 +125,10 @@ namespace tetmesh {
   }
 
   Point orient_surface(Grid& surface) {
-    Grid vol = volgrid_from_surface(surface);
+    InsideTest inside_test (surface);
 
     bool found_point = false;
-    for (const Element& e : surface.elements) {
+    for (ConstElementRef e : surface.elements) {
       assert (e.type == Shape::Triangle);
       const Point& p0 = surface.points[e.points[0]];
       const Point& p1 = surface.points[e.points[1]];
@@ -144,13 +143,13 @@ namespace tetmesh {
       Point test = p - n*1e-6;
       Point test2 = p + n*1e-6;
 
-      if (vol.test_point_inside(test))
+      if (inside_test.inside(test))
         return test;
-      else if (vol.test_point_inside(test2)) {
+      else if (inside_test.inside(test2)) {
 #ifndef NDEBUG
         fprintf(stderr,"(tetmesh::orient_surface) Reorienting Surface\n");
 #endif
-        for (Element& e : surface.elements) {
+        for (ElementRef e : surface.elements) {
           if (e.type != Shape::Triangle)
             fatal("(tetmesh::orient_surface) current only works with triangle surfaces");
           std::swap(e.points[1],e.points[2]);
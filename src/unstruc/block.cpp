@@ -3,6 +3,7 @@
 #include "point.h"
 #include "element.h"
 #include "grid.h"
+#include "index.h"
 
 #include <iostream>
 #include <sstream>
@@ -39,6 +40,16 @@ namespace unstruc {
     size_t offset = 0;
     std::stringstream ss;
     std::cerr << "Converting to unstructured grid" << std::endl;
+    // Hexas and boundary quads of every block
+    size_t n_points = 0, n_elements = 0;
+    for (const Block& blk : blocks) {
+      if (blk.size1 == 0 || blk.size2 == 0 || blk.size3 == 0) continue;
+      size_t ci = blk.size1 - 1, cj = blk.size2 - 1, ck = blk.size3 - 1;
+      n_points += blk.size1*blk.size2*blk.size3;
+      n_elements += ci*cj*ck + 2*(cj*ck + ci*ck + ci*cj);
+    }
+    check_index_range(n_points);
+    check_index_range(n_elements);
     size_t si,sj,sk;
     for (size_t ib = 0; ib < blocks.size(); ib++) {
       Block& blk = blocks[ib];
@@ -56,7 +67,7 @@ namespace unstruc {
       for (size_t i = 0; i < si-1; i++) {
         for (size_t j = 0; j < sj-1; j++) {
           for (size_t k = 0; k < sk-1; k++) {
-            Element e = Element(Shape::Hexa);
+            ElementRef e = grid.elements.emplace_back(Shape::Hexa);
             e.points[0] = offset+blk.index(i,j,k);
             e.points[1] = offset+blk.index(i+1,j,k);
             e.points[2] = offset+blk.index(i+1,j+1,k);
@@ -66,7 +77,6 @@ namespace unstruc {
             e.points[6] = offset+blk.index(i+1,j+1,k+1);
             e.points[7] = offset+blk.index(i,j+1,k+1);
             e.name_i = grid.names.size()-1;
-            grid.elements.push_back(e);
           }
         }
       }
@@ -77,13 +87,12 @@ namespace unstruc {
       size_t i = 0;
       for (size_t j = 0; j < sj-1; j++) {
         for (size_t k = 0; k < sk-1; k++) {
-          Element e = Element(Shape::Quad);
+          ElementRef e = grid.elements.emplace_back(Shape::Quad);
           e.points[0] = offset+blk.index(i,j,k);
           e.points[1] = offset+blk.index(i,j+1,k);
           e.points[2] = offset+blk.index(i,j+1,k+1);
           e.points[3] = offset+blk.index(i,j,k+1);
           e.name_i = grid.names.size()-1;
-          grid.elements.push_back(e);
         }
       }
       ss.str("");
@@ -93,13 +102,12 @@ namespace unstruc {
       i = si-1;
       for (size_t j = 0; j < sj-1; j++) {
         for (size_t k = 0; k < sk-1; k++) {
-          Element e = Element(Shape::Quad);
+          ElementRef e = grid.elements.emplace_back(Shape::Quad);
           e.points[0] = offset+blk.index(i,j,k);
           e.points[1] = offset+blk.index(i,j+1,k);
           e.points[2] = offset+blk.index(i,j+1,k+1);
           e.points[3] = offset+blk.index(i,j,k+1);
           e.name_i = grid.names.size()-1;
-          grid.elements.push_back(e);
         }
       }
       ss.str("");
@@ -109,13 +117,12 @@ namespace unstruc {
       size_t j = 0;
       for (size_t i = 0; i < si-1; i++) {
         for (size_t k = 0; k < sk-1; k++) {
-          Element e = Element(Shape::Quad);
+          ElementRef e = grid.elements.emplace_back(Shape::Quad);
           e.points[0] = offset+blk.index(i,j,k);
           e.points[1] = offset+blk.index(i+1,j,k);
           e.points[2] = offset+blk.index(i+1,j,k+1);
           e.points[3] = offset+blk.index(i,j,k+1);
           e.name_i = grid.names.size()-1;
-          grid.elements.push_back(e);
         }
       }
       ss.str("");
@@ -125,13 +132,12 @@ namespace unstruc {
       j = sj-1;
       for (size_t i = 0; i < si-1; i++) {
         for (size_t k = 0; k < sk-1; k++) {
-          Element e = Element(Shape::Quad);
+          ElementRef e = grid.elements.emplace_back(Shape::Quad);
           e.points[0] = offset+blk.index(i,j,k);
           e.points[1] = offset+blk.index(i+1,j,k);
           e.points[2] = offset+blk.index(i+1,j,k+1);
           e.points[3] = offset+blk.index(i,j,k+1);
           e.name_i = grid.names.size()-1;
-          grid.elements.push_back(e);
         }
       }
       ss.str("");
@@ -141,13 +147,12 @@ namespace unstruc {
       size_t k = 0;
       for (size_t i = 0; i < si-1; i++) {
         for (size_t j = 0; j < sj-1; j++) {
-          Element e = Element(Shape::Quad);
+          ElementRef e = grid.elements.emplace_back(Shape::Quad);
           e.points[0] = offset+blk.index(i,j,k);
           e.points[1] = offset+blk.index(i+1,j,k);
           e.points[2] = offset+blk.index(i+1,j+1,k);
           e.points[3] = offset+blk.index(i,j+1,k);
           e.name_i = grid.names.size()-1;
-          grid.elements.push_back(e);
         }
       }
       ss.str("");
@@ -157,13 +162,12 @@ namespace unstruc {
       k = sk-1;
       for (size_t i = 0; i < si-1; i++) {
         for (size_t j = 0; j < sj-1; j++) {
-          Element e = Element(Shape::Quad);
+          ElementRef e = grid.elements.emplace_back(Shape::Quad);
           e.points[0] = offset+blk.index(i,j,k);
           e.points[1] = offset+blk.index(i+1,j,k);
           e.points[2] = offset+blk.index(i+1,j+1,k);
           e.points[3] = offset+blk.index(i,j+1,k);
           e.name_i = grid.names.size()-1;
-          grid.elements.push_back(e);
         }
       }
       offset += si*sj*sk;
@@ -0,0 +1,126 @@
+#include "bvh.h"
+#include "error.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace unstruc {
+
+  namespace {
+    void set_leaf_box(BVH& tree, BVH::Node& node, const std::vector <Point>& mins, const std::vector <Point>& maxs) {
+      node.min = mins[tree.primitives[node.first]];
+      node.max = maxs[tree.primitives[node.first]];
+      for (Index i = node.first + 1; i < node.first + node.n; ++i) {
+        const Point& min = mins[tree.primitives[i]];
+        const Point& max = maxs[tree.primitives[i]];
+        node.min.x = std::min(node.min.x,min.x);
+        node.min.y = std::min(node.min.y,min.y);
+        node.min.z = std::min(node.min.z,min.z);
+        node.max.x = std::max(node.max.x,max.x);
+        node.max.y = std::max(node.max.y,max.y);
+        node.max.z = std::max(node.max.z,max.z);
+      }
+    }
+
+    void set_inner_box(BVH::Node& node, const BVH::Node& left, const BVH::Node& right) {
+      node.min.x = std::min(left.min.x,right.min.x);
+      node.min.y = std::min(left.min.y,right.min.y);
+      node.min.z = std::min(left.min.z,right.min.z);
+      node.max.x = std::max(left.max.x,right.max.x);
+      node.max.y = std::max(left.max.y,right.max.y);
+      node.max.z = std::max(left.max.z,right.max.z);
+    }
+
+    void build_node(BVH& tree, size_t i_node, size_t begin, size_t end, const std::vector <Point>& centers, const std::vector <Point>& mins, const std::vector <Point>& maxs, size_t leaf_size) {
+      if (end - begin <= leaf_size) {
+        BVH::Node& node = tree.nodes[i_node];
+        node.first = begin;
+        node.n = end - begin;
+        set_leaf_box(tree,node,mins,maxs);
+        return;
+      }
+
+      Point cmin = centers[tree.primitives[begin]];
+      Point cmax = cmin;
+      for (size_t i = begin + 1; i < end; ++i) {
+        const Point& c = centers[tree.primitives[i]];
+        cmin.x = std::min(cmin.x,c.x); cmax.x = std::max(cmax.x,c.x);
+        cmin.y = std::min(cmin.y,c.y); cmax.y = std::max(cmax.y,c.y);
+        cmin.z = std::min(cmin.z,c.z); cmax.z = std::max(cmax.z,c.z);
+      }
+      Vector extent = cmax - cmin;
+      int axis = 0;
+      if (extent.y > extent.x) axis = 1;
+      if (extent.z > std::max(extent.x,extent.y)) axis = 2;
+
+      // Ties are broken by primitive index so the tree does not depend on the
+      // nth_element implementation
+      size_t mid = (begin + end)/2;
+      std::nth_element(tree.primitives.begin() + begin,tree.primitives.begin() + mid,tree.primitives.begin() + end,
+          [&](Index a, Index b) {
+            double ca = axis == 0 ? centers[a].x : (axis == 1 ? centers[a].y : centers[a].z);
+            double cb = axis == 0 ? centers[b].x : (axis == 1 ? centers[b].y : centers[b].z);
+            if (ca != cb) return ca < cb;
+            return a < b;
+          });
+
+      size_t left = tree.nodes.size();
+      tree.nodes.resize(left + 2);
+      tree.parents.resize(left + 2,i_node);
+      tree.nodes[i_node].first = left;
+      tree.nodes[i_node].n = 0;
+      build_node(tree,left,begin,mid,centers,mins,maxs,leaf_size);
+      build_node(tree,left+1,mid,end,centers,mins,maxs,leaf_size);
+      set_inner_box(tree.nodes[i_node],tree.nodes[left],tree.nodes[left+1]);
+    }
+  }
+
+  void BVH::build(const std::vector <Point>& mins, const std::vector <Point>& maxs, size_t leaf_size) {
+    if (mins.size() != maxs.size()) fatal("(unstruc::BVH::build) Box arrays don't match");
+    if (leaf_size == 0) leaf_size = 1;
+    size_t n = mins.size();
+    check_index_range(2*n);
+
+    nodes.clear();
+    parents.clear();
+    primitives.resize(n);
+    for (size_t i = 0; i < n; ++i)
+      primitives[i] = i;
+    if (n == 0) return;
+
+    std::vector <Point> centers (n);
+    for (size_t i = 0; i < n; ++i)
+      centers[i] = (mins[i] + maxs[i])/2;
+
+    nodes.reserve(2*((n + leaf_size - 1)/leaf_size));
+    nodes.resize(1);
+    parents.assign(1,max_index);
+    build_node(*this,0,0,n,centers,mins,maxs,leaf_size);
+  }
+
+  void BVH::refit(const std::vector <Point>& mins, const std::vector <Point>& maxs) {
+    for (size_t i = nodes.size(); i-- > 0;) {
+      Node& node = nodes[i];
+      if (node.n)
+        set_leaf_box(*this,node,mins,maxs);
+      else
+        set_inner_box(node,nodes[node.first],nodes[node.first+1]);
+    }
+  }
+
+  void BVH::refit_leaves(const std::vector <Index>& leaves, const std::vector <Point>& mins, const std::vector <Point>& maxs) {
+    std::vector <Index> inner;
+    for (Index i : leaves) {
+      set_leaf_box(*this,nodes[i],mins,maxs);
+      for (Index p = parents[i]; p != max_index; p = parents[p])
+        inner.push_back(p);
+    }
+    // Children come after their parents, so going from the highest index down
+    // updates every child before its parent
+    std::sort(inner.begin(),inner.end(),std::greater<Index>());
+    inner.erase(std::unique(inner.begin(),inner.end()),inner.end());
+    for (Index i : inner)
+      set_inner_box(nodes[i],nodes[nodes[i].first],nodes[nodes[i].first+1]);
+  }
+
+} //namespace unstruc
@@ -33,7 +33,7 @@ namespace unstruc {
         if (cg_base_write(index_file,basename,cell_dim,phys_dim,&index_base)) close_file_and_exit();
 
         int n_volume_elements = 0;
-        for (const Element& e : grid.elements)
+        for (ConstElementRef e : grid.elements)
             if (Shape::Info[e.type].dim == grid.dim)
                 n_volume_elements++;
 
@@ -84,14 +84,14 @@ namespace unstruc {
         size_t element_data_size = 0;
         size_t default_count = 0;
         size_t default_data_size = 0;
-        for (const Element &e: grid.elements) {
+        for (ConstElementRef e: grid.elements) {
             if (Shape::Info[e.type].dim != (grid.dim)) continue;
             default_count++;
             default_data_size += e.points.size() + 1;
             element_data_size += e.points.size() + 1;
         }
 
-        for (const Element &e: grid.elements) {
+        for (ConstElementRef e: grid.elements) {
             if (Shape::Info[e.type].dim != (grid.dim-1)) continue;
             if (e.name_i == -1) continue;
             name_count[e.name_i]++;
@@ -99,12 +99,16 @@ namespace unstruc {
             element_data_size += e.points.size() + 1;
         }
 
-        std::vector<Element> sorted_elements = grid.elements;
-        std::sort(sorted_elements.begin(),sorted_elements.end(),[](const Element& e1, const Element& e2) {return e1.name_i < e2.name_i;});
+        std::vector<size_t> sorted_elements (grid.elements.size());
+        for (size_t i = 0; i < sorted_elements.size(); ++i)
+            sorted_elements[i] = i;
+        const std::vector<int>& name_indices = grid.elements.name_indices;
+        std::stable_sort(sorted_elements.begin(),sorted_elements.end(),[&name_indices](size_t e1, size_t e2) {return name_indices[e1] < name_indices[e2];});
 
         std::vector<int> element_data;
         element_data.reserve(element_data_size);
-        for (const Element& e: sorted_elements) {
+        for (size_t _e: sorted_elements) {
+            ConstElementRef e = grid.elements[_e];
             if (Shape::Info[e.type].dim != (grid.dim)) continue;
             ElementType_t data_type;
             switch (e.type) {
@@ -132,7 +136,8 @@ namespace unstruc {
                 element_data.push_back(p+1);
             }
         }
-        for (const Element& e: sorted_elements) {
+        for (size_t _e: sorted_elements) {
+            ConstElementRef e = grid.elements[_e];
             if (Shape::Info[e.type].dim != (grid.dim-1)) continue;
             if (e.name_i == -1) continue;
             ElementType_t data_type;
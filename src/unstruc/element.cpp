@@ -3,6 +3,7 @@
 #include "point.h"
 #include "error.h"
 #include "grid.h"
+#include "volumes.h"
 
 #include <algorithm>
 #include <string>
@@ -44,14 +45,99 @@ namespace unstruc {
     points.resize(Shape::Info[T].n_points);
   }
 
-  void dump(const Element &e) {
+  Element::Element(const ConstElementRef& e) : type(e.type), name_i(e.name_i), points(e.points.begin(),e.points.end()) {}
+
+  void ElementList::clear() {
+    types.clear();
+    name_indices.clear();
+    offsets.assign(1,0);
+    connectivity.clear();
+  }
+
+  void ElementList::reserve(size_t n_elements, size_t n_connectivity) {
+    types.reserve(n_elements);
+    name_indices.reserve(n_elements);
+    offsets.reserve(n_elements+1);
+    connectivity.reserve(n_connectivity);
+  }
+
+  void ElementList::resize(size_t n_elements) {
+    if (n_elements > size())
+      fatal("(ElementList::resize) Can only shrink list");
+    types.resize(n_elements);
+    name_indices.resize(n_elements);
+    offsets.resize(n_elements+1);
+    connectivity.resize(offsets.back());
+  }
+
+  ElementRef ElementList::emplace_back(Shape::Type type, int name_i, size_t n_points) {
+    if (n_points == 0)
+      n_points = Shape::Info[type].n_points;
+    types.push_back(type);
+    name_indices.push_back(name_i);
+    connectivity.resize(connectivity.size() + n_points);
+    offsets.push_back(connectivity.size());
+    return back();
+  }
+
+  void ElementList::push_back(ConstElementRef e) {
+    types.push_back(e.type);
+    name_indices.push_back(e.name_i);
+    connectivity.insert(connectivity.end(),e.points.begin(),e.points.end());
+    offsets.push_back(connectivity.size());
+  }
+
+  void ElementList::append(const ElementList& other, Index point_offset, int name_offset) {
+    size_t connectivity_offset = connectivity.size();
+    types.insert(types.end(),other.types.begin(),other.types.end());
+
+    name_indices.reserve(name_indices.size() + other.name_indices.size());
+    for (int name_i : other.name_indices)
+      name_indices.push_back(name_i + name_offset);
+
+    offsets.reserve(offsets.size() + other.size());
+    for (size_t i = 1; i < other.offsets.size(); ++i)
+      offsets.push_back(other.offsets[i] + connectivity_offset);
+
+    connectivity.reserve(connectivity.size() + other.connectivity.size());
+    for (Index p : other.connectivity)
+      connectivity.push_back(p + point_offset);
+  }
+
+  void ElementList::erase(const std::vector <bool>& erased) {
+    size_t n_elements = size();
+    size_t new_i = 0;
+    size_t new_offset = 0;
+    for (size_t i = 0; i < n_elements; ++i) {
+      if (erased[i]) continue;
+      size_t begin = offsets[i];
+      size_t end = offsets[i+1];
+      types[new_i] = types[i];
+      name_indices[new_i] = name_indices[i];
+      offsets[new_i] = new_offset;
+      for (size_t j = begin; j < end; ++j)
+        connectivity[new_offset++] = connectivity[j];
+      new_i++;
+    }
+    offsets[new_i] = new_offset;
+    resize(new_i);
+  }
+
+  void ElementList::swap(ElementList& other) {
+    types.swap(other.types);
+    name_indices.swap(other.name_indices);
+    offsets.swap(other.offsets);
+    connectivity.swap(other.connectivity);
+  }
+
+  void dump(ConstElementRef e) {
     std::cerr << "Element " << Shape::Info[e.type].name << std::endl;
     for (size_t p : e.points) {
       printf("Point %d\n",p);
     }
   };
 
-  void dump(const Element &e, const Grid &grid) {
+  void dump(ConstElementRef e, const Grid &grid) {
     std::cerr << "Element " << Shape::Info[e.type].name << std::endl;
     for (size_t p : e.points) {
       printf("Point %d : ",p);
@@ -60,6 +146,10 @@ namespace unstruc {
   };
 
   double Element::calc_volume(const Grid& grid) const {
+    return ConstElementRef(*this).calc_volume(grid);
+  }
+
+  double ConstElementRef::calc_volume(const Grid& grid) const {
     switch (type) {
     case Shape::Line:
     case Shape::Triangle:
@@ -67,119 +157,30 @@ namespace unstruc {
     case Shape::Polygon:
       return 0;
     case Shape::Hexa:
-      {
-        const Point& p0 = grid.points[points[0]];
-        const Point& p1 = grid.points[points[1]];
-        const Point& p2 = grid.points[points[2]];
-        const Point& p3 = grid.points[points[3]];
-        const Point& p4 = grid.points[points[4]];
-        const Point& p5 = grid.points[points[5]];
-        const Point& p6 = grid.points[points[6]];
-        const Point& p7 = grid.points[points[7]];
-
-        Point face_center1 { 0, 0, 0};
-        double total_length1 = 0;
-        for (size_t i = 0; i < 4; ++i) {
-          size_t j = (i + 1)%4;
-          const Point& pi = grid.points[points[i]];
-          const Point& pj = grid.points[points[j]];
-          double l = (pj - pi).length();
-          total_length1 += l;
-
-          face_center1 += (pi + pj)/2*l;
-        }
-        face_center1 /= total_length1;
-
-        Point face_center2 { 0, 0, 0 };
-        double total_length2 = 0;
-        for (size_t i = 4; i < 8; ++i) {
-          size_t j = 4 + (i + 1)%4;
-          const Point& pi = grid.points[points[i]];
-          const Point& pj = grid.points[points[j]];
-          double l = (pj - pi).length();
-          total_length2 += l;
-
-          face_center2 += (pi + pj)/2*l;
-        }
-        face_center2 /= total_length2;
-
-        Vector l = face_center2 - face_center1;
-        Vector v02 = p2 - p0;
-        Vector v13 = p3 - p1;
-        Vector n1 = cross(v02,v13)/2;
-
-        Vector v46 = p6 - p4;
-        Vector v57 = p7 - p5;
-        Vector n2 = cross(v46,v57)/2;
-
-        return (dot(l,n1) + dot(l,n2))/2;
-      }
+      return hexa_volume(grid.points.data(),points.begin());
     case Shape::Tetra:
-      {
-        const Point& p0 = grid.points[points[0]];
-        const Point& p1 = grid.points[points[1]];
-        const Point& p2 = grid.points[points[2]];
-        const Point& p3 = grid.points[points[3]];
-        Vector v1 = p1 - p0;
-        Vector v2 = p2 - p1;
-        Vector v = cross(v1,v2);
-        Vector v3 = p3 - p1;
-        return dot(v,v3)/6;
-      }
+      return tetra_volume(grid.points.data(),points.begin());
     case Shape::Wedge:
-      {
-        const Point& p0 = grid.points[points[0]];
-        const Point& p1 = grid.points[points[1]];
-        const Point& p2 = grid.points[points[2]];
-        const Point& p3 = grid.points[points[3]];
-        const Point& p4 = grid.points[points[4]];
-        const Point& p5 = grid.points[points[5]];
-
-        Point c1 = (p0 + p1 + p2)/3;
-        Point c2 = (p3 + p4 + p5)/3;
-
-        Vector l = c1 - c2;
-        Vector v01 = p1 - p0;
-        Vector v12 = p2 - p1;
-        Vector n1 = cross(v01,v12)/2;
-        Vector v34 = p4 - p3;
-        Vector v45 = p5 - p4;
-        Vector n2 = cross(v34,v45)/2;
-        return (dot(l,n1) + dot(l,n2))/2;
-      }
+      return wedge_volume(grid.points.data(),points.begin());
     case Shape::Pyramid:
-      {
-        const Point& p0 = grid.points[points[0]];
-        const Point& p1 = grid.points[points[1]];
-        const Point& p2 = grid.points[points[2]];
-        const Point& p3 = grid.points[points[3]];
-        const Point& p4 = grid.points[points[4]];
-
-        Vector v1 = p2 - p0;
-        Vector v2 = p3 - p1;
-        Vector v = cross(v1,v2);
-        Vector v3 = p4 - p0;
-        Vector v4 = p4 - p1;
-        return dot(v3,v)/12 + dot(v4,v)/12;
-      }
+      return pyramid_volume(grid.points.data(),points.begin());
     default:
       fatal("Invalid Element Type");
     }
     return 0;
   }
 
-  bool same(Element e1, Element e2) {
+  bool same(ConstElementRef e1, ConstElementRef e2) {
     if (e1.type != e2.type) return false;
-    std::sort(e1.points.begin(),e1.points.end());
-    std::sort(e2.points.begin(),e2.points.end());
-    for (size_t i = 0; i < e1.points.size(); i++) {
-      if (e1.points[i] != e2.points[i])
-        return false;
-    }
-    return true;
+    if (e1.points.size() != e2.points.size()) return false;
+    std::vector<Index> points1 (e1.points.begin(),e1.points.end());
+    std::vector<Index> points2 (e2.points.begin(),e2.points.end());
+    std::sort(points1.begin(),points1.end());
+    std::sort(points2.begin(),points2.end());
+    return points1 == points2;
   };
 
-  bool can_collapse(const Element& e) {
+  bool can_collapse(ConstElementRef e) {
     for (size_t i = 0; i < e.points.size()-1; i++)
       for (size_t j = i+1; j < e.points.size(); j++)
         if (e.points[i] == e.points[j]) return true;
@@ -505,7 +506,7 @@ namespace unstruc {
     return false;
   }
 
-  bool can_collapse_wo_split(const Element& e) {
+  bool can_collapse_wo_split(ConstElementRef e) {
     switch (e.type) {
     case Shape::Wedge:
       return (e.points[0] == e.points[3] || e.points[1] == e.points[4] || e.points[2] == e.points[5]);
@@ -1,4 +1,5 @@
 #include "error.h"
+#include "index.h"
 
 #include <iostream>
 #include <string>
@@ -26,4 +27,9 @@ namespace unstruc {
     exit(1);
   }
 
+  void check_index_range(size_t n) {
+    if (n > max_index)
+      fatal("Mesh is too large for the index type. Rebuild with UNSTRUC_64BIT_INDEX");
+  }
+
 } //namespace unstruc
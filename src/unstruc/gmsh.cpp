@@ -24,7 +24,7 @@ namespace unstruc {
     fprintf(f,"$EndNodes\n");
     fprintf(f,"$Elements %lu\n",grid.elements.size());
     for (size_t i = 0; i < grid.elements.size(); i++) {
-      const Element &e = grid.elements[i];
+      ConstElementRef e = grid.elements[i];
       size_t eltype = 0;
       switch (e.type) {
       case Shape::Quad:
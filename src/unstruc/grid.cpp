@@ -2,6 +2,7 @@
 #include "element.h"
 #include "point.h"
 #include "error.h"
+#include "parallel.h"
 
 #include <cassert>
 #include <cmath>
@@ -10,6 +11,9 @@
 #include <utility>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <functional>
+#include <cstdint>
 
 namespace unstruc {
 
@@ -17,56 +21,154 @@ namespace unstruc {
     names.push_back( Name(dim, "default") );
   }
 
+  namespace {
+    struct PointCell {
+      int64_t i, j, k;
+      Index p;
+      bool operator<(const PointCell& other) const {
+        if (i != other.i) return i < other.i;
+        if (j != other.j) return j < other.j;
+        if (k != other.k) return k < other.k;
+        return p < other.p;
+      };
+      bool same_cell(const PointCell& other) const {
+        return i == other.i && j == other.j && k == other.k;
+      };
+    };
+
+    // Concurrent union-find forest. Roots are always linked below the root
+    // with the lower index, so the root of every set is its lowest index
+    // regardless of the order the unions are done in
+    Index find_root(std::vector< std::atomic<Index> >& parent, Index i) {
+      Index p = parent[i].load();
+      while (p != i) {
+        Index gp = parent[p].load();
+        if (gp != p)
+          parent[i].compare_exchange_weak(p,gp);
+        i = p;
+        p = parent[i].load();
+      }
+      return i;
+    }
+
+    void unite(std::vector< std::atomic<Index> >& parent, Index a, Index b) {
+      while (true) {
+        a = find_root(parent,a);
+        b = find_root(parent,b);
+        if (a == b) return;
+        if (a > b) std::swap(a,b);
+        Index expected = b;
+        if (parent[b].compare_exchange_strong(expected,a)) return;
+      }
+    }
+  }
+
+  // Points are binned into a uniform grid of cells that are at least tol wide,
+  // so only points in the same or neighbouring cells need to be compared.
+  // Points within tol of each other, directly or through a chain of points, are
+  // merged into the lowest index point of the cluster
   void Grid::merge_points(double tol) {
     std::cerr << "Merging Points" << std::endl;
-    size_t n_merged = 0;
     size_t n_points = points.size();
 
+    Point min = n_points ? points[0] : Point {0,0,0};
+    Point max = min;
+    for (const Point& p : points) {
+      min.x = std::min(min.x,p.x); max.x = std::max(max.x,p.x);
+      min.y = std::min(min.y,p.y); max.y = std::max(max.y,p.y);
+      min.z = std::min(min.z,p.z); max.z = std::max(max.z,p.z);
+    }
+
+    // Limit the number of cells per direction so cell indices can't overflow.
+    // Cells exactly tol wide only contain points within tol of each other
+    double extent = std::max(max.x - min.x,std::max(max.y - min.y,max.z - min.z));
+    double h = std::max(tol,ldexp(extent,-40));
+    if (h == 0) h = 1;
+    bool cells_within_tol = (h == tol);
+
     std::cerr << "Sorting Points By Location" << std::endl;
-    std::vector< std::pair<double,size_t> > s (n_points);
+    std::vector<PointCell> s (n_points);
+    parallel_for(n_points,[&](size_t i) {
+      const Point& p = points[i];
+      s[i].i = floor((p.x - min.x)/h);
+      s[i].j = floor((p.y - min.y)/h);
+      s[i].k = floor((p.z - min.z)/h);
+      s[i].p = i;
+    });
+    parallel_sort(s.begin(),s.end(),std::less<PointCell>());
+
+    std::vector<size_t> cell_start;
     for (size_t i = 0; i < n_points; ++i) {
-      Point& p = points[i];
-      s[i] = std::make_pair(p.x+p.y+p.z,i);
+      if (i == 0 || !s[i].same_cell(s[i-1]))
+        cell_start.push_back(i);
     }
+    size_t n_cells = cell_start.size();
+    cell_start.push_back(n_points);
 
-    sort(s.begin(),s.end());
-
-    std::vector<size_t> merged_index (n_points);
-    for (size_t i = 0; i < n_points; i++)
-      merged_index[i] = i;
+    std::vector< std::atomic<Index> > parent (n_points);
+    parallel_for(n_points,[&](size_t i) { parent[i].store(i); });
 
     std::cerr << "Comparing Points" << std::endl;
-    for (size_t _i = 0; _i < n_points; _i++) {
-      double si = s[_i].first;
-      size_t i = s[_i].second;
-      Point& p1 = points[i];
-      for (size_t _j = _i+1; _j < n_points; _j++) {
-        double sj = s[_j].first;
-        size_t j = s[_j].second;
-        // Check if point has already been merged
-        if (merged_index[j] != j) continue;
-
-        Point& p2 = points[j];
-        if (fabs(si - sj) > 3*tol) break;
-        if (same(p1,p2,tol)) {
-          merged_index[j] = i;
-          n_merged++;
+    parallel_for(n_cells,[&](size_t c) {
+      size_t begin = cell_start[c];
+      size_t end = cell_start[c+1];
+      if (cells_within_tol) {
+        for (size_t _i = begin+1; _i < end; ++_i)
+          unite(parent,s[begin].p,s[_i].p);
+      } else {
+        for (size_t _i = begin; _i < end; ++_i) {
+          for (size_t _j = _i+1; _j < end; ++_j) {
+            Index i = s[_i].p;
+            Index j = s[_j].p;
+            if (find_root(parent,i) != find_root(parent,j) && same(points[i],points[j],tol))
+              unite(parent,i,j);
+          }
         }
       }
-    }
 
+      // Compare against the 13 neighbouring cells that sort after this one.
+      // The other 13 neighbours handle the pairs with this cell themselves
+      for (int di = 0; di <= 1; ++di) {
+        for (int dj = (di ? -1 : 0); dj <= 1; ++dj) {
+          PointCell key = s[begin];
+          key.i += di;
+          key.j += dj;
+          key.k += (di || dj) ? -1 : 1;
+          key.p = 0;
+          size_t _c = std::lower_bound(cell_start.begin(),cell_start.begin()+n_cells,key,
+              [&](size_t start, const PointCell& value) { return s[start] < value; }) - cell_start.begin();
+          for (; _c < n_cells; ++_c) {
+            const PointCell& other = s[cell_start[_c]];
+            if (other.i != key.i || other.j != key.j || other.k > s[begin].k + 1) break;
+            if (cells_within_tol && find_root(parent,s[begin].p) == find_root(parent,other.p)) continue;
+            for (size_t _i = begin; _i < end; ++_i) {
+              for (size_t _j = cell_start[_c]; _j < cell_start[_c+1]; ++_j) {
+                Index i = s[_i].p;
+                Index j = s[_j].p;
+                if (find_root(parent,i) != find_root(parent,j) && same(points[i],points[j],tol))
+                  unite(parent,i,j);
+              }
+            }
+          }
+        }
+      }
+    },64);
+
+    std::vector<Index> merged_index (n_points);
+    parallel_for(n_points,[&](size_t i) { merged_index[i] = find_root(parent,i); });
+
+    size_t n_merged = 0;
     std::vector <bool> seen_points (n_points,false);
-    for (Element& e : elements)
-      for (size_t& p : e.points)
-        seen_points[p] = true;
+    for (Index p : elements.connectivity)
+      seen_points[merged_index[p]] = true;
 
     std::cerr << "Assembling Final Index" << std::endl;
-    std::vector<size_t> new_index (n_points);
-    for (size_t i = 0; i < n_points; ++i)
-      new_index[i] = -1;
+    std::vector<Index> new_index (n_points,max_index);
     size_t new_i = 0;
     for (size_t i = 0; i < n_points; ++i) {
-      if (merged_index[i] == i && seen_points[i]) {
+      if (merged_index[i] != i) {
+        n_merged++;
+      } else if (seen_points[i]) {
         points[new_i] = points[i];
         new_index[i] = new_i;
         new_i++;
@@ -79,63 +181,77 @@ namespace unstruc {
     }
     std::cerr << n_merged << " Points Merged" << std::endl;
     std::cerr << "Updating Elements" << std::endl;
-    for (Element& e : elements)
-      for (size_t& p : e.points)
-        p = new_index[p];
+    parallel_for(elements.connectivity.size(),[&](size_t i) {
+      elements.connectivity[i] = new_index[elements.connectivity[i]];
+    });
   }
 
+  // Faces are keyed by their type and sorted point list and inserted into a
+  // lock-free open addressing table. A face that finds an identical face
+  // already in the table marks both as deleted, so every face that appears
+  // more than once is removed
   void Grid::delete_inner_faces() {
     std::cerr << "Deleting Inner Faces" << std::endl;
     size_t n_elements = elements.size();
-    size_t n_points = points.size();
-
-    std::cerr << "Sorting Points By Location" << std::endl;
-    std::vector< std::pair<size_t,size_t> > s (n_elements);
-    for (size_t i = 0; i < n_elements; ++i) {
-      size_t min_p = n_points;
-      for (size_t p : elements[i].points)
-        if (p < min_p)
-          min_p = p;
-      s[i] = std::make_pair(min_p,i);
-    }
 
-    sort(s.begin(),s.end());
-
-    std::vector<bool> deleted_index (n_elements);
-    for (size_t i = 0; i < n_elements; i++)
-      deleted_index[i] = false;
-
-    fprintf(stderr,"Comparing Points\n");
-    for (size_t _i = 0; _i < n_elements; _i++) {
-      size_t si = s[_i].first;
-      size_t i = s[_i].second;
-      Element &ei = elements[i];
-      if (Shape::Info[ei.type].dim == dim) continue;
-      for (size_t _j = _i+1; _j < n_elements; _j++) {
-        size_t sj = s[_j].first;
-        size_t j = s[_j].second;
-        Element &ej = elements[j];
-        if (Shape::Info[ej.type].dim == dim) continue;
-        if (deleted_index[j]) continue;
-        if (si != sj) break;
-        if (same(ei,ej)) {
-          deleted_index[i] = true;
-          deleted_index[j] = true;
+    std::cerr << "Hashing Faces" << std::endl;
+    std::vector<Index> sorted (elements.connectivity);
+    std::vector<uint64_t> hash (n_elements);
+    parallel_for(n_elements,[&](size_t i) {
+      if (Shape::Info[elements.types[i]].dim == dim) return;
+      Index* first = sorted.data() + elements.offsets[i];
+      Index* last = sorted.data() + elements.offsets[i+1];
+      std::sort(first,last);
+      uint64_t h = elements.types[i];
+      for (Index* p = first; p != last; ++p)
+        h = (h ^ *p) * 0x100000001b3ULL;
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      hash[i] = h;
+    });
+
+    auto same_face = [&](size_t i, size_t j) {
+      if (elements.types[i] != elements.types[j]) return false;
+      if (elements.n_points(i) != elements.n_points(j)) return false;
+      return std::equal(sorted.begin() + elements.offsets[i],sorted.begin() + elements.offsets[i+1],sorted.begin() + elements.offsets[j]);
+    };
+
+    size_t table_size = 1;
+    while (table_size < 2*n_elements)
+      table_size *= 2;
+    std::vector< std::atomic<Index> > table (table_size);
+    parallel_for(table_size,[&](size_t i) { table[i].store(max_index); });
+    std::vector< std::atomic<bool> > deleted (n_elements);
+    parallel_for(n_elements,[&](size_t i) { deleted[i].store(false); });
+
+    std::cerr << "Comparing Faces" << std::endl;
+    parallel_for(n_elements,[&](size_t i) {
+      if (Shape::Info[elements.types[i]].dim == dim) return;
+      size_t slot = hash[i] & (table_size - 1);
+      while (true) {
+        Index j = table[slot].load();
+        if (j == max_index) {
+          if (table[slot].compare_exchange_strong(j,i)) return;
         }
+        if (hash[j] == hash[i] && same_face(i,j)) {
+          deleted[i].store(true);
+          deleted[j].store(true);
+          return;
+        }
+        slot = (slot + 1) & (table_size - 1);
       }
-    }
+    });
+
     size_t n_deleted = 0;
-    size_t new_i = 0;
+    std::vector<bool> deleted_index (n_elements);
     for (size_t i = 0; i < n_elements; ++i) {
-      if (deleted_index[i]) {
+      deleted_index[i] = deleted[i].load();
+      if (deleted_index[i])
         n_deleted++;
-      } else {
-        elements[new_i] = Element (elements[i]);
-        new_i++;
-      }
     }
-    elements.resize(new_i);
-    fprintf(stderr,"%d Faces Deleted\n",n_deleted);
+    elements.erase(deleted_index);
+    fprintf(stderr,"%lu Faces Deleted\n",n_deleted);
   }
 
   void Grid::collapse_elements(bool split) {
@@ -144,44 +260,61 @@ namespace unstruc {
     std::vector<Element> new_elements;
     size_t n_collapsed = 0;
     size_t n_deleted = 0;
-    std::vector<bool> deleted_elements (n_elements,false);
+    // Collapsed elements never have more points than the original, so the
+    // element list can be rewritten in place
+    size_t new_i = 0;
+    size_t new_offset = 0;
     for (size_t i = 0; i < n_elements; ++i) {
-      Element& e = elements[i];
+      ConstElementRef e = elements[i];
+      bool collapsible;
       if (split) {
-        if (can_collapse(e)) {
-          bool deleted = collapse(e,new_elements);
-          if (deleted) {
-            n_deleted++;
-            deleted_elements[i] = true;
-          }
-          n_collapsed++;
-        }
+        collapsible = can_collapse(e);
       } else {
-        if (can_collapse_wo_split(e)) {
-          bool deleted = collapse_wo_split(e);
-          if (deleted) {
-            n_deleted++;
-            deleted_elements[i] = true;
-          }
-          n_collapsed++;
-        } else if (can_collapse(e))
+        collapsible = can_collapse_wo_split(e);
+        if (!collapsible && can_collapse(e))
           fatal("Can't collapse without splitting");
       }
-    }
-    std::cerr << n_collapsed << " Elements Collapsed" << std::endl;
-    std::cerr << n_deleted << " Elements Deleted On Collapse" << std::endl;
-    size_t new_i = 0;
-    for (size_t i = 0; i < n_elements; ++i) {
-      if (!deleted_elements[i]) {
-        elements[new_i] = elements[i];
-        new_i++;
+
+      Element collapsed;
+      bool deleted = false;
+      if (collapsible) {
+        collapsed = Element(e);
+        if (split)
+          deleted = collapse(collapsed,new_elements);
+        else
+          deleted = collapse_wo_split(collapsed);
+        n_collapsed++;
+        if (deleted) {
+          n_deleted++;
+          continue;
+        }
+      }
+
+      size_t begin = elements.offsets[i];
+      size_t end = elements.offsets[i+1];
+      elements.offsets[new_i] = new_offset;
+      if (collapsible) {
+        elements.types[new_i] = collapsed.type;
+        elements.name_indices[new_i] = collapsed.name_i;
+        for (size_t p : collapsed.points)
+          elements.connectivity[new_offset++] = p;
+      } else {
+        elements.types[new_i] = elements.types[i];
+        elements.name_indices[new_i] = elements.name_indices[i];
+        for (size_t j = begin; j < end; ++j)
+          elements.connectivity[new_offset++] = elements.connectivity[j];
       }
+      new_i++;
     }
+    elements.offsets[new_i] = new_offset;
     elements.resize(new_i);
+    std::cerr << n_collapsed << " Elements Collapsed" << std::endl;
+    std::cerr << n_deleted << " Elements Deleted On Collapse" << std::endl;
 
     if (split) {
       size_t n_added = new_elements.size();
-      elements.insert(elements.end(),new_elements.begin(),new_elements.end());
+      for (const Element& e : new_elements)
+        elements.push_back(e);
       std::cerr << n_added << " Elements Created On Collapse" << std::endl;
     }
   };
@@ -189,28 +322,65 @@ namespace unstruc {
   Grid& Grid::operator+=(const Grid& other) {
     if (dim != other.dim)
       fatal("Dimensions must match");
+    check_index_range(points.size() + other.points.size());
+    check_index_range(elements.size() + other.elements.size());
     size_t point_offset = points.size();
     size_t name_offset = names.size();
     points.insert(points.end(),other.points.begin(),other.points.end());
     names.insert(names.end(),other.names.begin(),other.names.end());
-    elements.reserve(elements.size() + other.elements.size());
-    for (Element e : other.elements) {
-      for (size_t i = 0; i < e.points.size(); ++i) {
-        e.points[i] += point_offset;
-      }
-      e.name_i += name_offset;
-      elements.push_back(e);
+    elements.append(other.elements,point_offset,name_offset);
+    return *this;
+  }
+
+  Grid& Grid::operator+=(Grid&& other) {
+    if (dim != other.dim)
+      fatal("Dimensions must match");
+    if (points.size() || elements.size()) {
+      check_index_range(points.size() + other.points.size());
+      check_index_range(elements.size() + other.elements.size());
+      size_t point_offset = points.size();
+      size_t name_offset = names.size();
+      points.insert(points.end(),other.points.begin(),other.points.end());
+      elements.append(other.elements,point_offset,name_offset);
+      names.insert(names.end(),std::make_move_iterator(other.names.begin()),std::make_move_iterator(other.names.end()));
+      return *this;
     }
+    int name_offset = names.size();
+    points = std::move(other.points);
+    elements = std::move(other.elements);
+    for (int& name_i : elements.name_indices)
+      name_i += name_offset;
+    names.insert(names.end(),std::make_move_iterator(other.names.begin()),std::make_move_iterator(other.names.end()));
     return *this;
   }
 
+  void Grid::append(const std::vector <const Grid*>& others) {
+    size_t n_points = points.size();
+    size_t n_elements = elements.size();
+    size_t n_connectivity = elements.connectivity.size();
+    size_t n_names = names.size();
+    for (const Grid* other : others) {
+      if (dim != other->dim)
+        fatal("Dimensions must match");
+      n_points += other->points.size();
+      n_elements += other->elements.size();
+      n_connectivity += other->elements.connectivity.size();
+      n_names += other->names.size();
+    }
+    points.reserve(n_points);
+    elements.reserve(n_elements,n_connectivity);
+    names.reserve(n_names);
+    for (const Grid* other : others)
+      *this += *other;
+  }
+
   void Grid::delete_empty_names() {
     std::vector<bool> name_exists(names.size());
     for (size_t i = 0; i < names.size(); ++i)
       name_exists[i] = false;
 
-    for (Element& e: elements) {
-      name_exists[e.name_i] = true;
+    for (int name_i : elements.name_indices) {
+      name_exists[name_i] = true;
     }
 
     std::vector<int> name_map(names.size());
@@ -225,13 +395,13 @@ namespace unstruc {
     }
     names.resize(i);
 
-    for (Element& e: elements)
-      e.name_i = name_map[e.name_i];
+    for (int& name_i : elements.name_indices)
+      name_i = name_map[name_i];
   }
 
   bool Grid::test_point_inside(Point const& p) {
     bool inside = false;
-    for (Element const& e : elements) {
+    for (ConstElementRef e : elements) {
       if (e.type != Shape::Tetra)
         not_implemented("test_point_inside_volume only surpports Tetra's");
       Point const& p0 = points[e.points[0]];
@@ -272,7 +442,7 @@ namespace unstruc {
       return false;
     }
     size_t n_points = points.size();
-    for (const Element& e : elements) {
+    for (ConstElementRef e : elements) {
       if (e.type == Shape::Undefined) {
         fprintf(stderr,"Undefined shape\n");
         return false;
@@ -321,13 +491,13 @@ namespace unstruc {
     return max;
   }
 
-  Grid Grid::grid_from_element_index(const std::vector <size_t>& element_index) const {
+  Grid Grid::grid_from_element_index(const std::vector <Index>& element_index) const {
     Grid extracted (dim);
     extracted.points = points;
     extracted.names = names;
 
-    extracted.elements.reserve(element_index.size());
-    for (size_t _e : element_index) {
+    extracted.elements.reserve(element_index.size(),0);
+    for (Index _e : element_index) {
       if (_e >= elements.size())
         fatal("Non-existent element referenced");
       extracted.elements.push_back(elements[_e]);
@@ -335,4 +505,27 @@ namespace unstruc {
     return extracted;
   }
 
+  std::vector <Index> Grid::connected_components(size_t& n_components) const {
+    std::vector< std::atomic<Index> > parent (points.size());
+    parallel_for(points.size(),[&](size_t i) { parent[i].store(i); });
+    parallel_for(elements.size(),[&](size_t i) {
+      ConstElementRef e = elements[i];
+      for (size_t j = 1; j < e.points.size(); ++j)
+        unite(parent,e.points[0],e.points[j]);
+    });
+
+    std::vector <Index> root_component (points.size(),max_index);
+    std::vector <Index> component (elements.size());
+    n_components = 0;
+    for (size_t i = 0; i < elements.size(); ++i) {
+      ConstElementRef e = elements[i];
+      if (e.points.size() == 0) fatal("(unstruc::Grid::connected_components) Element without points");
+      Index root = find_root(parent,e.points[0]);
+      if (root_component[root] == max_index)
+        root_component[root] = n_components++;
+      component[i] = root_component[root];
+    }
+    return component;
+  }
+
 } //namespace unstruc
@@ -0,0 +1,69 @@
+#include "gridview.h"
+
+#include "grid.h"
+#include "error.h"
+#include "parallel.h"
+
+#include <algorithm>
+
+namespace unstruc {
+
+  GridView::GridView(const Grid& grid, const std::vector <Index>& element_index) :
+    grid(grid), element_index(element_index.data(),element_index.size()) {
+    for (Index _e : element_index) {
+      if (_e >= grid.elements.size())
+        fatal("(unstruc::GridView) Non-existent element referenced");
+    }
+  }
+
+  ConstElementRef GridView::operator[](size_t i) const {
+    return grid.elements[element_index[i]];
+  }
+
+  // Sorting the referenced points keeps the memory used proportional to the
+  // size of the view rather than the size of the grid
+  std::vector <Index> GridView::used_points() const {
+    std::vector <Index> points;
+    for (Index _e : element_index) {
+      ConstElementRef e = grid.elements[_e];
+      points.insert(points.end(),e.points.begin(),e.points.end());
+    }
+    parallel_sort(points.begin(),points.end(),std::less<Index>());
+    points.erase(std::unique(points.begin(),points.end()),points.end());
+    return points;
+  }
+
+  Grid GridView::compact() const {
+    std::vector <Index> points = used_points();
+    Grid compacted (grid.dim);
+    compacted.names = grid.names;
+    compacted.points.resize(points.size());
+    parallel_for(points.size(),[&](size_t i) { compacted.points[i] = grid.points[points[i]]; });
+
+    size_t n_connectivity = 0;
+    for (Index _e : element_index)
+      n_connectivity += grid.elements.n_points(_e);
+    compacted.elements.reserve(element_index.size(),n_connectivity);
+    for (Index _e : element_index) {
+      ConstElementRef e = grid.elements[_e];
+      ElementRef compacted_e = compacted.elements.emplace_back(e.type,e.name_i,e.points.size());
+      for (size_t j = 0; j < e.points.size(); ++j)
+        compacted_e.points[j] = std::lower_bound(points.begin(),points.end(),e.points[j]) - points.begin();
+    }
+    return compacted;
+  }
+
+  Grid GridView::to_grid() const {
+    Grid extracted (grid.dim);
+    extracted.points = grid.points;
+    extracted.names = grid.names;
+    size_t n_connectivity = 0;
+    for (Index _e : element_index)
+      n_connectivity += grid.elements.n_points(_e);
+    extracted.elements.reserve(element_index.size(),n_connectivity);
+    for (Index _e : element_index)
+      extracted.elements.push_back(grid.elements[_e]);
+    return extracted;
+  }
+
+} //namespace unstruc
@@ -0,0 +1,160 @@
+#include "halfedge.h"
+
+#include "grid.h"
+#include "error.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace unstruc {
+
+  // Twins are found from the half-edges leaving each point, so no global sort
+  // or hash of the edges is needed
+  HalfEdgeSurface::HalfEdgeSurface(const Grid& surface) {
+    const ElementList& elements = surface.elements;
+    size_t n_half_edges = elements.connectivity.size();
+    size_t n_points = surface.points.size();
+    check_index_range(n_half_edges);
+
+    for (size_t i = 0; i < elements.size(); ++i) {
+      if (Shape::Info[elements.types[i]].dim != 2)
+        fatal("(unstruc::HalfEdgeSurface) Not a surface. Has non-surface elements");
+      if (elements.n_points(i) < 3)
+        fatal("(unstruc::HalfEdgeSurface) Element with less than three points");
+    }
+    for (Index p : elements.connectivity) {
+      if (p >= n_points)
+        fatal("(unstruc::HalfEdgeSurface) Element references non-existent point");
+    }
+
+    origin = elements.connectivity;
+    next.resize(n_half_edges);
+    prev.resize(n_half_edges);
+    element.resize(n_half_edges);
+    parallel_for(elements.size(),[&](size_t i) {
+      size_t first = elements.offsets[i];
+      size_t n = elements.n_points(i);
+      for (size_t j = 0; j < n; ++j) {
+        next[first + j] = first + (j + 1)%n;
+        prev[first + j] = first + (j + n - 1)%n;
+        element[first + j] = i;
+      }
+    });
+
+    std::vector< std::atomic<size_t> > counts (n_points + 1);
+    parallel_for(counts.size(),[&](size_t i) { counts[i].store(0,std::memory_order_relaxed); });
+    parallel_for(n_half_edges,[&](size_t h) { counts[origin[h]].fetch_add(1,std::memory_order_relaxed); });
+    point_offsets.resize(n_points + 1);
+    point_offsets[0] = 0;
+    for (size_t p = 0; p < n_points; ++p)
+      point_offsets[p+1] = point_offsets[p] + counts[p].load(std::memory_order_relaxed);
+    parallel_for(n_points,[&](size_t p) { counts[p].store(point_offsets[p],std::memory_order_relaxed); });
+    point_half_edges.resize(n_half_edges);
+    parallel_for(n_half_edges,[&](size_t h) {
+      point_half_edges[counts[origin[h]].fetch_add(1,std::memory_order_relaxed)] = h;
+    });
+    parallel_for(n_points,[&](size_t p) {
+      std::sort(point_half_edges.begin() + point_offsets[p],point_half_edges.begin() + point_offsets[p+1]);
+    });
+
+    // Every half-edge on the edge a-b leaves either a for b or b for a
+    enum { Manifold, Boundary, NonManifold };
+    std::vector <unsigned char> kind (n_half_edges);
+    twin.resize(n_half_edges);
+    parallel_for(n_half_edges,[&](size_t h) {
+      Index a = origin[h];
+      Index b = target(h);
+      size_t n_found = 0;
+      Index other = max_index;
+      for (size_t i = point_offsets[a]; i < point_offsets[a+1]; ++i) {
+        Index h2 = point_half_edges[i];
+        if (h2 != h && target(h2) == b) {
+          n_found++;
+          other = h2;
+        }
+      }
+      for (size_t i = point_offsets[b]; i < point_offsets[b+1]; ++i) {
+        Index h2 = point_half_edges[i];
+        if (target(h2) == a) {
+          n_found++;
+          other = h2;
+        }
+      }
+      if (n_found == 1) {
+        twin[h] = other;
+        kind[h] = Manifold;
+      } else {
+        twin[h] = max_index;
+        kind[h] = n_found == 0 ? Boundary : NonManifold;
+      }
+    });
+    for (size_t h = 0; h < n_half_edges; ++h) {
+      if (kind[h] == Boundary)
+        boundary_half_edges.push_back(h);
+      else if (kind[h] == NonManifold)
+        nonmanifold_half_edges.push_back(h);
+    }
+  }
+
+  // The walk leaves each element through its other edge at p. Which one that
+  // is depends on whether p is the start or the end of the edge it entered
+  // through, so this works for inconsistently oriented elements as well
+  size_t HalfEdgeSurface::fan_size(Index p) const {
+    if (n_point_half_edges(p) == 0) return 0;
+    Index start = point_half_edges[point_offsets[p]];
+    Index h = start;
+    size_t n = 1;
+    while (true) {
+      Index exit = origin[h] == p ? prev[h] : next[h];
+      h = twin[exit];
+      if (h == max_index || element[h] == element[start]) break;
+      if (++n > n_point_half_edges(p)) break;
+    }
+    return n;
+  }
+
+  bool HalfEdgeSurface::orient(std::vector <bool>& flip) const {
+    size_t n_elements = element.size() ? element.back() + 1 : 0;
+    flip.assign(n_elements,false);
+    std::vector <bool> visited (n_elements,false);
+    std::vector <Index> queue;
+    queue.reserve(n_elements);
+
+    // Half-edges of an element are contiguous, starting at the one whose
+    // previous half-edge is the last
+    std::vector <Index> first_half_edge (n_elements);
+    for (size_t h = 0; h < element.size(); ++h) {
+      if (prev[h] > h)
+        first_half_edge[element[h]] = h;
+    }
+
+    bool orientable = true;
+    for (size_t seed = 0; seed < n_elements; ++seed) {
+      if (visited[seed]) continue;
+      visited[seed] = true;
+      queue.clear();
+      queue.push_back(seed);
+      for (size_t q = 0; q < queue.size(); ++q) {
+        Index e = queue[q];
+        Index h = first_half_edge[e];
+        do {
+          if (twin[h] != max_index) {
+            Index e2 = element[twin[h]];
+            bool f = consistent(h) ? flip[e] : !flip[e];
+            if (!visited[e2]) {
+              visited[e2] = true;
+              flip[e2] = f;
+              queue.push_back(e2);
+            } else if (flip[e2] != f) {
+              orientable = false;
+            }
+          }
+          h = next[h];
+        } while (h != first_half_edge[e]);
+      }
+    }
+    return orientable;
+  }
+
+} //namespace unstruc
@@ -0,0 +1,122 @@
+#include "inside.h"
+
+#include "grid.h"
+#include "error.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace unstruc {
+
+  namespace {
+    // Ray directions tried in order. They are far from the coordinate axes
+    // and planes, so rays rarely run along the edges of structured surfaces
+    const Vector ray_directions[] = {
+      Vector { 0.5773502691896258, 0.5877852522924731, 0.5669872981077807 },
+      Vector { -0.3090169943749474, 0.8090169943749475, 0.5 },
+      Vector { 0.7071067811865476, -0.2588190451025208, 0.6580751451100836 },
+      Vector { -0.6234898018587336, -0.4338837391175581, 0.6502878401571168 },
+      Vector { 0.2225209339563144, 0.4045084971874737, -0.8870108331782217 },
+      Vector { -0.9009688679024191, 0.1736481776669303, -0.3977050868561036 },
+    };
+    const size_t n_ray_directions = sizeof(ray_directions)/sizeof(ray_directions[0]);
+
+    // Random directions tried once all the fixed ones are ambiguous
+    const size_t n_random_directions = 64;
+
+    // Relative tolerance on the barycentric coordinates below which a ray is
+    // treated as hitting an edge or vertex
+    const double edge_tolerance = 1e-9;
+
+    enum RayHit { Miss, Hit, Ambiguous };
+
+    RayHit ray_triangle(const Point& origin, const Vector& dir, const Point& p0, const Point& p1, const Point& p2) {
+      Vector e1 = p1 - p0;
+      Vector e2 = p2 - p0;
+      Vector pv = cross(dir,e2);
+      double det = dot(e1,pv);
+      if (det == 0) return Miss;
+      Vector tv = origin - p0;
+      double u = dot(tv,pv)/det;
+      if (u < -edge_tolerance || u > 1 + edge_tolerance) return Miss;
+      Vector qv = cross(tv,e1);
+      double v = dot(dir,qv)/det;
+      if (v < -edge_tolerance || u + v > 1 + edge_tolerance) return Miss;
+      double t = dot(e2,qv)/det;
+      if (t < 0) return Miss;
+      if (u < edge_tolerance || v < edge_tolerance || u + v > 1 - edge_tolerance) return Ambiguous;
+      return Hit;
+    }
+
+    std::vector <Index> all_elements(const Grid& grid) {
+      std::vector <Index> elements (grid.elements.size());
+      for (size_t i = 0; i < elements.size(); ++i)
+        elements[i] = i;
+      return elements;
+    }
+  }
+
+  InsideTest::InsideTest(const Grid& surface) : InsideTest(surface,all_elements(surface)) {}
+
+  InsideTest::InsideTest(const Grid& surface, const std::vector <Index>& elements) {
+    points.reserve(3*elements.size());
+    std::vector <Point> mins (elements.size());
+    std::vector <Point> maxs (elements.size());
+    for (size_t i = 0; i < elements.size(); ++i) {
+      ConstElementRef e = surface.elements[elements[i]];
+      if (e.type != Shape::Triangle)
+        not_implemented("(unstruc::InsideTest) Only triangle surfaces are supported");
+      const Point& p0 = surface.points[e.points[0]];
+      const Point& p1 = surface.points[e.points[1]];
+      const Point& p2 = surface.points[e.points[2]];
+      points.push_back(p0);
+      points.push_back(p1);
+      points.push_back(p2);
+      mins[i] = Point { std::min(std::min(p0.x,p1.x),p2.x), std::min(std::min(p0.y,p1.y),p2.y), std::min(std::min(p0.z,p1.z),p2.z) };
+      maxs[i] = Point { std::max(std::max(p0.x,p1.x),p2.x), std::max(std::max(p0.y,p1.y),p2.y), std::max(std::max(p0.z,p1.z),p2.z) };
+    }
+    tree.build(mins,maxs,4);
+  }
+
+  // A ray that hits an edge or vertex can't be counted reliably, so another
+  // direction is tried. After the fixed directions come random ones from a
+  // fixed seed, so the answer doesn't depend on the run. A point on an edge
+  // is ambiguous in every direction, which is an error
+  bool InsideTest::inside(const Point& p) const {
+    bool is_inside = false;
+    auto cast = [&](const Vector& dir) {
+      Vector inv_dir { 1/dir.x, 1/dir.y, 1/dir.z };
+      bool ambiguous = false;
+      size_t n_hits = 0;
+      tree.query_ray(p,inv_dir,[&](Index i) {
+        if (ambiguous) return;
+        RayHit hit = ray_triangle(p,dir,points[3*i],points[3*i+1],points[3*i+2]);
+        if (hit == Hit)
+          n_hits++;
+        else if (hit == Ambiguous)
+          ambiguous = true;
+      });
+      is_inside = (n_hits % 2 == 1);
+      return !ambiguous;
+    };
+
+    for (size_t d = 0; d < n_ray_directions; ++d) {
+      if (cast(ray_directions[d]))
+        return is_inside;
+    }
+    std::mt19937 random (n_ray_directions);
+    std::uniform_real_distribution<double> uniform (-1,1);
+    for (size_t d = 0; d < n_random_directions; ++d) {
+      Vector dir;
+      do {
+        dir = Vector { uniform(random), uniform(random), uniform(random) };
+      } while (dir.length() < 0.1 || dir.length() > 1);
+      if (cast(dir.normalized()))
+        return is_inside;
+    }
+    fatal("(unstruc::InsideTest) Every ray from the point hits an edge or vertex");
+    return false;
+  }
+
+} //namespace unstruc
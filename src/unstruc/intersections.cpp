@@ -2,10 +2,14 @@
 
 #include "point.h"
 #include "grid.h"
+#include "gridview.h"
 #include "error.h"
 #include "io.h"
+#include "bvh.h"
+#include "parallel.h"
 
 #include <array>
+#include <atomic>
 #include <cfloat>
 #include <algorithm>
 #include <vector>
@@ -13,23 +17,24 @@
 #include <cassert>
 #include <ctime>
 #include <cfloat>
-#include <memory>
-#include <bitset>
 #include <iostream>
 #include <utility>
+#include <functional>
+#include <cstdlib>
 
-namespace unstruc {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
 
-  const size_t max_depth = 10;
-  const size_t max_bin_size = 20;
+namespace unstruc {
 
   struct Edge {
-    size_t p1, p2;
-    std::vector <size_t> elements;
+    Index p1, p2;
+    std::vector <Index> elements;
     Point min, max;
 
     Edge() {};
-    Edge(size_t _p1,size_t _p2) {
+    Edge(Index _p1,Index _p2) {
       if (_p1 < _p2) {
         p1 = _p1;
         p2 = _p2;
@@ -39,7 +44,7 @@ namespace unstruc {
       }
     };
 
-    Edge(size_t _p1,size_t _p2,size_t e) {
+    Edge(Index _p1,Index _p2,Index e) {
       if (_p1 < _p2) {
         p1 = _p1;
         p2 = _p2;
@@ -69,8 +74,8 @@ namespace unstruc {
   };
 
   struct Face {
-    std::vector<size_t> points;
-    std::vector <size_t> elements;
+    std::vector<Index> points;
+    std::vector <Index> elements;
 
     Point center;
     Vector normal;
@@ -88,13 +93,67 @@ namespace unstruc {
     }
   };
 
+  void set_edge_properties(const Grid& grid, Edge& edge) {
+    const Point& p1 = grid.points[edge.p1];
+    const Point& p2 = grid.points[edge.p2];
+    edge.min.x = std::min(p1.x,p2.x);
+    edge.min.y = std::min(p1.y,p2.y);
+    edge.min.z = std::min(p1.z,p2.z);
+    edge.max.x = std::max(p1.x,p2.x);
+    edge.max.y = std::max(p1.y,p2.y);
+    edge.max.z = std::max(p1.z,p2.z);
+  }
+
+  void set_face_properties(const Grid& grid, Face& face) {
+    const Point& p0 = grid.points[face.points[0]];
+    const Point& p1 = grid.points[face.points[1]];
+    const Point& p2 = grid.points[face.points[2]];
+    face.min.x = std::min(std::min(p0.x,p1.x),p2.x);
+    face.min.y = std::min(std::min(p0.y,p1.y),p2.y);
+    face.min.z = std::min(std::min(p0.z,p1.z),p2.z);
+    face.max.x = std::max(std::max(p0.x,p1.x),p2.x);
+    face.max.y = std::max(std::max(p0.y,p1.y),p2.y);
+    face.max.z = std::max(std::max(p0.z,p1.z),p2.z);
+    if (face.points.size() == 3) {
+      face.normal = cross(p1-p0, p2-p1);
+      face.center = (p0 + p1 + p2)/3;
+    } else {
+      const Point& p3 = grid.points[face.points[3]];
+      face.normal = cross(p2-p0, p3-p1);
+
+      face.center = Point { 0, 0, 0 };
+      double total_length = 0;
+      for (size_t i = 0; i < 4; ++i) {
+        const Point& p0 = grid.points[face.points[i]];
+        const Point& p1 = grid.points[face.points[(i+1)%4]];
+        const Point& p2 = grid.points[face.points[(i+2)%4]];
+
+        Vector v1 = p1 - p0;
+        Vector v2 = p2 - p1;
+        double length = cross(v1,v2).length();
+
+        face.center += (p0 + p1 + p2)/3*length;
+        total_length += length;
+      }
+      if (total_length > 0)
+        face.center /= total_length;
+
+      face.min.x = std::min(face.min.x,p3.x);
+      face.min.y = std::min(face.min.y,p3.y);
+      face.min.z = std::min(face.min.z,p3.z);
+      face.max.x = std::max(face.max.x,p3.x);
+      face.max.y = std::max(face.max.y,p3.y);
+      face.max.z = std::max(face.max.z,p3.z);
+    }
+  }
+
   std::vector<Edge> get_edges(const Grid& grid) {
     std::vector<Edge> edges;
 #ifndef NDEBUG
     fprintf(stderr,"Create Edges\n");
 #endif
     size_t n_edges = 0;
-    for (const Element& e : grid.elements) {
+    for (ConstElementRef e : grid.elements) {
       size_t n = Shape::Info[e.type].n_edges;
       if (n == 0) fatal();
       n_edges += n;
@@ -102,7 +161,7 @@ namespace unstruc {
     edges.reserve(n_edges);
 
     for (size_t _e = 0; _e < grid.elements.size(); ++_e) {
-      const Element& e = grid.elements[_e];
+      ConstElementRef e = grid.elements[_e];
       if (e.type == Shape::Wedge) {
         edges.push_back( Edge(e.points[0],e.points[1],_e) );
         edges.push_back( Edge(e.points[1],e.points[2],_e) );
@@ -131,14 +190,13 @@ namespace unstruc {
 #ifndef NDEBUG
     fprintf(stderr,"Sorting Faces\n");
 #endif
-    std::sort(edges.begin(),edges.end());
+    parallel_sort(edges.begin(),edges.end(),std::less<Edge>());
     size_t i_edge = 0;
 #ifndef NDEBUG
     fprintf(stderr,"Checking Edges for Duplicates\n");
 #endif
     for (size_t i = 0; i < edges.size(); ++i) {
       Edge& edge = edges[i];
-      std::vector <size_t> elements;
       while (i+1 < edges.size() && edge == edges[i+1]) {
         Edge& edge1 = edges[i+1];
         edge.elements.push_back(edge1.elements[0]);
@@ -152,16 +210,7 @@ namespace unstruc {
 #ifndef NDEBUG
     fprintf(stderr,"Setting Edge Properties\n");
 #endif
-    for (Edge& edge : edges) {
-      const Point& p1 = grid.points[edge.p1];
-      const Point& p2 = grid.points[edge.p2];
-      edge.min.x = std::min(p1.x,p2.x);
-      edge.min.y = std::min(p1.y,p2.y);
-      edge.min.z = std::min(p1.z,p2.z);
-      edge.max.x = std::max(p1.x,p2.x);
-      edge.max.y = std::max(p1.y,p2.y);
-      edge.max.z = std::max(p1.z,p2.z);
-    }
+    parallel_for(edges.size(),[&](size_t i) { set_edge_properties(grid,edges[i]); });
     return edges;
   };
 
@@ -171,7 +220,7 @@ namespace unstruc {
 #endif
     std::vector<Face> faces;
     size_t n_faces = 0;
-    for (const Element& e : grid.elements) {
+    for (ConstElementRef e : grid.elements) {
       size_t n = Shape::Info[e.type].n_faces;
       if (n == 0) fatal();
       n_faces += n;
@@ -179,7 +228,7 @@ namespace unstruc {
     faces.reserve(n_faces);
     //Create Faces from Elements
     for (size_t _e = 0; _e < grid.elements.size(); ++_e) {
-      const Element& e = grid.elements[_e];
+      ConstElementRef e = grid.elements[_e];
       if (e.type == Shape::Wedge) {
         Face face1;
         face1.elements.push_back(_e);
@@ -221,7 +270,7 @@ namespace unstruc {
       } else if (e.type == Shape::Triangle || e.type == Shape::Quad) {
         Face face;
         face.elements.push_back(_e);
-        face.points = e.points;
+        face.points.assign(e.points.begin(),e.points.end());
         faces.push_back(face);
       } else
         fatal("Shape not supported");
@@ -237,7 +286,7 @@ namespace unstruc {
       face_sort[i].first = face;
       face_sort[i].second = i;
     }
-    std::sort(face_sort.begin(),face_sort.end());
+    parallel_sort(face_sort.begin(),face_sort.end(),std::less< std::pair<Face,size_t> >());
     std::vector <size_t> face_indices;
     size_t i_face = 0;
 #ifndef NDEBUG
@@ -267,401 +316,475 @@ namespace unstruc {
 #ifndef NDEBUG
     fprintf(stderr,"Setting Face Properties\n");
 #endif
-    for (Face& face : faces) {
-      const Point& p0 = grid.points[face.points[0]];
-      const Point& p1 = grid.points[face.points[1]];
-      const Point& p2 = grid.points[face.points[2]];
-      face.min.x = std::min(std::min(p0.x,p1.x),p2.x);
-      face.min.y = std::min(std::min(p0.y,p1.y),p2.y);
-      face.min.z = std::min(std::min(p0.z,p1.z),p2.z);
-      face.max.x = std::max(std::max(p0.x,p1.x),p2.x);
-      face.max.y = std::max(std::max(p0.y,p1.y),p2.y);
-      face.max.z = std::max(std::max(p0.z,p1.z),p2.z);
-      if (face.points.size() == 3) {
-        face.normal = cross(p1-p0, p2-p1);
-        face.center = (p0 + p1 + p2)/3;
-      } else {
-        const Point& p3 = grid.points[face.points[3]];
-        face.normal = cross(p2-p0, p3-p1);
-
-        face.center = Point { 0, 0, 0 };
-        double total_length = 0;
-        for (size_t i = 0; i < 4; ++i) {
-          const Point& p0 = grid.points[face.points[i]];
-          const Point& p1 = grid.points[face.points[(i+1)%4]];
-          const Point& p2 = grid.points[face.points[(i+2)%4]];
-
-          Vector v1 = p1 - p0;
-          Vector v2 = p2 - p1;
-          double length = cross(v1,v2).length();
-
-          face.center += (p0 + p1 + p2)/3*length;
-          total_length += length;
-        }
-        if (total_length > 0)
-          face.center /= total_length;
-
-        face.min.x = std::min(face.min.x,p3.x);
-        face.min.y = std::min(face.min.y,p3.y);
-        face.min.z = std::min(face.min.z,p3.z);
-        face.max.x = std::max(face.max.x,p3.x);
-        face.max.y = std::max(face.max.y,p3.y);
-        face.max.z = std::max(face.max.z,p3.z);
-      }
-    }
+    parallel_for(faces.size(),[&](size_t i) { set_face_properties(grid,faces[i]); });
     return faces;
   };
 
 
-  struct Octree {
-    std::array < std::unique_ptr<Octree>, 8 > children;
-    std::array < std::vector<size_t> , 8> points;
-    std::array < std::vector<Edge> , 8> edges;
-    std::array < std::vector<Face> , 8> faces;
-    Point center;
-    double radius;
+  // Faces grouped four at a time in structure of arrays layout, so one edge
+  // can be tested against the whole block at once. Triangles repeat their
+  // first point in the fourth slot. Unused slots have inverted bounds and a
+  // zero normal so no edge can hit them
+  struct FaceBlock {
+    double min[3][4];
+    double max[3][4];
+    double center[3][4];
+    double normal[3][4];
+    double points[4][3][4]; // face point, component, slot
+    double quad[4];
+    Index faces[4];
   };
 
-  Vector quadrant_vector(uint8_t i) {
-    Vector v {-1,-1,-1};
-    if (i & 1) v.x = 1;
-    if (i & 2) v.y = 1;
-    if (i & 4) v.z = 1;
-    return v;
-  }
-
-  std::unique_ptr<Octree> build_octree(const Grid& grid, std::vector<size_t> points, const Point& center, const double radius, size_t depth) {
-    std::unique_ptr<Octree> tree (new Octree);
-    if (depth > max_depth)
-      return nullptr;
-    tree->center = center;
-    tree->radius = radius;
-
-    for (size_t _p : points) {
-      const Point& p = grid.points[_p];
-      uint8_t loc = 0;
-      if (p.x > center.x) loc |= 1;
-      if (p.y > center.y) loc |= 2;
-      if (p.z > center.z) loc |= 4;
-      tree->points[loc].push_back(_p);
-    }
-
-    for (uint8_t i = 0; i < 8; ++i) {
-      if (tree->points[i].size() > max_bin_size) {
-        Point new_center = center + quadrant_vector(i)*(radius/2);
-        tree->children[i] = std::move(build_octree(grid, tree->points[i], new_center, radius/2, depth+1));
-        if (tree->children[i])
-          tree->points[i].clear();
-      }
-    }
+  struct EdgeData {
+    Point p1, p2, min, max;
+    Vector vector;
+  };
 
-    return tree;
+  EdgeData edge_data(const Grid& grid, const Edge& edge) {
+    EdgeData e;
+    e.p1 = grid.points[edge.p1];
+    e.p2 = grid.points[edge.p2];
+    e.min = edge.min;
+    e.max = edge.max;
+    e.vector = e.p2 - e.p1;
+    return e;
   }
 
-  std::unique_ptr<Octree> create_octree_root(const Grid& grid) {
-    Point min { DBL_MAX, DBL_MAX, DBL_MAX };
-    Point max { DBL_MIN, DBL_MIN, DBL_MIN };
-
-    for (const Point& p : grid.points) {
-      if (p.x < min.x) min.x = p.x;
-      if (p.y < min.y) min.y = p.y;
-      if (p.z < min.z) min.z = p.z;
-      if (p.x > max.x) max.x = p.x;
-      if (p.y > max.y) max.y = p.y;
-      if (p.z > max.z) max.z = p.z;
-    }
-
-    Point center = (min + max)/2;
-    Vector corner = max - center;
-    double radius = std::max(std::max(corner.x,corner.y),corner.z);
-
-    std::vector<size_t> points (grid.points.size());;
-    for (size_t i = 0; i < grid.points.size(); ++i)
-      points[i] = i;
+  void set_block_face(FaceBlock& block, size_t slot, const Grid& grid, const std::vector<Face>& faces, Index _f) {
+    const Face& face = faces[_f];
+    const double min[3] = { face.min.x, face.min.y, face.min.z };
+    const double max[3] = { face.max.x, face.max.y, face.max.z };
+    const double center[3] = { face.center.x, face.center.y, face.center.z };
+    const double normal[3] = { face.normal.x, face.normal.y, face.normal.z };
+    for (size_t c = 0; c < 3; ++c) {
+      block.min[c][slot] = min[c];
+      block.max[c][slot] = max[c];
+      block.center[c][slot] = center[c];
+      block.normal[c][slot] = normal[c];
+    }
+    for (size_t k = 0; k < 4; ++k) {
+      const Point& p = grid.points[face.points[k < face.points.size() ? k : 0]];
+      block.points[k][0][slot] = p.x;
+      block.points[k][1][slot] = p.y;
+      block.points[k][2][slot] = p.z;
+    }
+    block.quad[slot] = face.points.size() == 4 ? 1 : 0;
+    block.faces[slot] = _f;
+  }
 
-    return build_octree(grid,points,center,radius,0);
+  void clear_block_slot(FaceBlock& block, size_t slot) {
+    for (size_t c = 0; c < 3; ++c) {
+      block.min[c][slot] = DBL_MAX;
+      block.max[c][slot] = -DBL_MAX;
+      block.center[c][slot] = 0;
+      block.normal[c][slot] = 0;
+      for (size_t k = 0; k < 4; ++k)
+        block.points[k][c][slot] = 0;
+    }
+    block.quad[slot] = 0;
+    block.faces[slot] = max_index;
   }
 
-  void print_octree(const std::unique_ptr<Octree>& tree,size_t indent) {
-    for (size_t i = 0; i < 8; ++i) {
-      if (tree->children[i] || tree->points[i].size()) {
-        for (size_t j = 0; j < indent; ++j) printf(" ");
-        printf("Quadrant %zu -> ",i);
-
-        if (tree->children[i]) {
-          printf("\n");
-          print_octree(tree->children[i],indent+1);
-        } else {
-          printf("%lu Points\n",tree->points[i].size());
+  // Returns a bit mask of the slots in the block whose face the edge crosses.
+  // This does not check for points shared by index, see edge_hits_block. The
+  // vectorized kernels below must do exactly the same floating point
+  // operations in the same order so the results don't depend on the kernel
+  unsigned edge_block_scalar(const EdgeData& e, const FaceBlock& b) {
+    unsigned hits = 0;
+    for (size_t s = 0; s < 4; ++s) {
+      if (e.min.x > b.max[0][s] || e.min.y > b.max[1][s] || e.min.z > b.max[2][s]) continue;
+      if (e.max.x < b.min[0][s] || e.max.y < b.min[1][s] || e.max.z < b.min[2][s]) continue;
+
+      bool same = false;
+      for (size_t k = 0; k < 4; ++k) {
+        Point p { b.points[k][0][s], b.points[k][1][s], b.points[k][2][s] };
+        if (e.p1 == p || e.p2 == p)
+          same = true;
+      }
+      if (same) continue;
+
+      Vector normal { b.normal[0][s], b.normal[1][s], b.normal[2][s] };
+      Point center { b.center[0][s], b.center[1][s], b.center[2][s] };
+      double denom = dot(e.vector,normal);
+      if (denom == 0) continue;
+      double scale = dot(e.p1 - center,normal)/denom;
+      if (!(-1 <= scale && scale <= 0)) continue;
+
+      Point proj = e.p1 - e.vector*scale;
+      size_t n = b.quad[s] > 0 ? 4 : 3;
+      bool intersected = true;
+      for (size_t k = 0; k < n; ++k) {
+        size_t k1 = (k+1)%4;
+        Point p0 { b.points[k][0][s], b.points[k][1][s], b.points[k][2][s] };
+        Point p1 { b.points[k1][0][s], b.points[k1][1][s], b.points[k1][2][s] };
+        Vector v1 = p1 - p0;
+        Vector v2 = proj - p1;
+        Vector nk = cross(v1,v2);
+        if (dot(nk,normal) <= 0) {
+          intersected = false;
+          break;
         }
       }
+      if (intersected)
+        hits |= 1u << s;
     }
+    return hits;
   }
 
-  Grid octree_to_grid(const std::unique_ptr<Octree>& tree) {
-    Grid grid (3);
-    for (uint8_t i = 0; i < 8; ++i) {
-      if (tree->children[i]) {
-        grid += octree_to_grid(tree->children[i]);
-      } else if (tree->points[i].size()) {
-        Point quad_extreme = tree->center + quadrant_vector(i)*tree->radius;
-        size_t _p = grid.points.size();
-        grid.points.push_back( Point { tree->center.x, tree->center.y, tree->center.z } );
-        grid.points.push_back( Point { quad_extreme.x, tree->center.y, tree->center.z } );
-        grid.points.push_back( Point { quad_extreme.x, quad_extreme.y, tree->center.z } );
-        grid.points.push_back( Point { tree->center.x, quad_extreme.y, tree->center.z } );
-        grid.points.push_back( Point { tree->center.x, tree->center.y, quad_extreme.z } );
-        grid.points.push_back( Point { quad_extreme.x, tree->center.y, quad_extreme.z } );
-        grid.points.push_back( Point { quad_extreme.x, quad_extreme.y, quad_extreme.z } );
-        grid.points.push_back( Point { tree->center.x, quad_extreme.y, quad_extreme.z } );
-        Element e (Shape::Hexa);
-        for (size_t j = 0; j < 8; ++j)
-          e.points[j] = _p+j;
-        grid.elements.push_back(e);
-      }
-    }
-    return grid;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UNSTRUC_AVX_KERNEL
+
+  __attribute__((target("avx")))
+  unsigned edge_block_avx(const EdgeData& e, const FaceBlock& b) {
+    const __m256d zero = _mm256_setzero_pd();
+
+    __m256d reject = _mm256_cmp_pd(_mm256_set1_pd(e.min.x),_mm256_loadu_pd(b.max[0]),_CMP_GT_OQ);
+    reject = _mm256_or_pd(reject,_mm256_cmp_pd(_mm256_set1_pd(e.min.y),_mm256_loadu_pd(b.max[1]),_CMP_GT_OQ));
+    reject = _mm256_or_pd(reject,_mm256_cmp_pd(_mm256_set1_pd(e.min.z),_mm256_loadu_pd(b.max[2]),_CMP_GT_OQ));
+    reject = _mm256_or_pd(reject,_mm256_cmp_pd(_mm256_set1_pd(e.max.x),_mm256_loadu_pd(b.min[0]),_CMP_LT_OQ));
+    reject = _mm256_or_pd(reject,_mm256_cmp_pd(_mm256_set1_pd(e.max.y),_mm256_loadu_pd(b.min[1]),_CMP_LT_OQ));
+    reject = _mm256_or_pd(reject,_mm256_cmp_pd(_mm256_set1_pd(e.max.z),_mm256_loadu_pd(b.min[2]),_CMP_LT_OQ));
+    if (_mm256_movemask_pd(reject) == 0xF) return 0;
+
+    const __m256d e1x = _mm256_set1_pd(e.p1.x), e1y = _mm256_set1_pd(e.p1.y), e1z = _mm256_set1_pd(e.p1.z);
+    const __m256d e2x = _mm256_set1_pd(e.p2.x), e2y = _mm256_set1_pd(e.p2.y), e2z = _mm256_set1_pd(e.p2.z);
+    __m256d px[4], py[4], pz[4];
+    for (size_t k = 0; k < 4; ++k) {
+      px[k] = _mm256_loadu_pd(b.points[k][0]);
+      py[k] = _mm256_loadu_pd(b.points[k][1]);
+      pz[k] = _mm256_loadu_pd(b.points[k][2]);
+      __m256d same1 = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(e1x,px[k],_CMP_EQ_OQ),_mm256_cmp_pd(e1y,py[k],_CMP_EQ_OQ)),_mm256_cmp_pd(e1z,pz[k],_CMP_EQ_OQ));
+      __m256d same2 = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(e2x,px[k],_CMP_EQ_OQ),_mm256_cmp_pd(e2y,py[k],_CMP_EQ_OQ)),_mm256_cmp_pd(e2z,pz[k],_CMP_EQ_OQ));
+      reject = _mm256_or_pd(reject,_mm256_or_pd(same1,same2));
+    }
+
+    const __m256d nx = _mm256_loadu_pd(b.normal[0]), ny = _mm256_loadu_pd(b.normal[1]), nz = _mm256_loadu_pd(b.normal[2]);
+    const __m256d evx = _mm256_set1_pd(e.vector.x), evy = _mm256_set1_pd(e.vector.y), evz = _mm256_set1_pd(e.vector.z);
+    __m256d denom = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(evx,nx),_mm256_mul_pd(evy,ny)),_mm256_mul_pd(evz,nz));
+    reject = _mm256_or_pd(reject,_mm256_cmp_pd(denom,zero,_CMP_EQ_OQ));
+
+    __m256d dx = _mm256_sub_pd(e1x,_mm256_loadu_pd(b.center[0]));
+    __m256d dy = _mm256_sub_pd(e1y,_mm256_loadu_pd(b.center[1]));
+    __m256d dz = _mm256_sub_pd(e1z,_mm256_loadu_pd(b.center[2]));
+    __m256d num = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx,nx),_mm256_mul_pd(dy,ny)),_mm256_mul_pd(dz,nz));
+    __m256d scale = _mm256_div_pd(num,denom);
+    __m256d in_range = _mm256_and_pd(_mm256_cmp_pd(scale,_mm256_set1_pd(-1),_CMP_GE_OQ),_mm256_cmp_pd(scale,zero,_CMP_LE_OQ));
+    reject = _mm256_or_pd(reject,_mm256_andnot_pd(in_range,_mm256_castsi256_pd(_mm256_set1_epi64x(-1))));
+    if (_mm256_movemask_pd(reject) == 0xF) return 0;
+
+    __m256d projx = _mm256_sub_pd(e1x,_mm256_mul_pd(evx,scale));
+    __m256d projy = _mm256_sub_pd(e1y,_mm256_mul_pd(evy,scale));
+    __m256d projz = _mm256_sub_pd(e1z,_mm256_mul_pd(evz,scale));
+    __m256d quad = _mm256_cmp_pd(_mm256_loadu_pd(b.quad),zero,_CMP_GT_OQ);
+    for (size_t k = 0; k < 4; ++k) {
+      size_t k1 = (k+1)%4;
+      __m256d v1x = _mm256_sub_pd(px[k1],px[k]);
+      __m256d v1y = _mm256_sub_pd(py[k1],py[k]);
+      __m256d v1z = _mm256_sub_pd(pz[k1],pz[k]);
+      __m256d v2x = _mm256_sub_pd(projx,px[k1]);
+      __m256d v2y = _mm256_sub_pd(projy,py[k1]);
+      __m256d v2z = _mm256_sub_pd(projz,pz[k1]);
+      __m256d cx = _mm256_sub_pd(_mm256_mul_pd(v1y,v2z),_mm256_mul_pd(v1z,v2y));
+      __m256d cy = _mm256_sub_pd(_mm256_mul_pd(v1z,v2x),_mm256_mul_pd(v1x,v2z));
+      __m256d cz = _mm256_sub_pd(_mm256_mul_pd(v1x,v2y),_mm256_mul_pd(v1y,v2x));
+      __m256d d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(cx,nx),_mm256_mul_pd(cy,ny)),_mm256_mul_pd(cz,nz));
+      __m256d outside = _mm256_cmp_pd(d,zero,_CMP_LE_OQ);
+      if (k == 3)
+        outside = _mm256_and_pd(outside,quad);
+      reject = _mm256_or_pd(reject,outside);
+    }
+    return ~_mm256_movemask_pd(reject) & 0xF;
   }
+#endif
 
-  const std::bitset <8> x_bitset ("01010101");
-  const std::bitset <8> y_bitset ("00110011");
-  const std::bitset <8> z_bitset ("00001111");
-  size_t put_edge_in_tree(std::unique_ptr<Octree>& tree, const Edge& edge) {
-    size_t n_added = 0;
-    std::bitset <8> overlap  ("11111111");
-
-    if (edge.min.x > tree->center.x)
-      overlap &= ~x_bitset;
-    else if (edge.max.x < tree->center.x)
-      overlap &= x_bitset;
-
-    if (edge.min.y > tree->center.y)
-      overlap &= ~y_bitset;
-    else if (edge.max.y < tree->center.y)
-      overlap &= y_bitset;
-
-    if (edge.min.z > tree->center.z)
-      overlap &= ~z_bitset;
-    else if (edge.max.z < tree->center.z)
-      overlap &= z_bitset;
-
-    for (size_t i = 0; i < 8; ++i) {
-      if (overlap[i]) {
-        if (tree->children[i]) {
-          n_added += put_edge_in_tree(tree->children[i],edge);
-        } else {
-          tree->edges[i].push_back(edge);
-          n_added++;
-        }
-      }
-    }
-    return n_added;
+  typedef unsigned (*EdgeBlockKernel)(const EdgeData& e, const FaceBlock& b);
+
+  // Picks the widest kernel the CPU supports. Setting UNSTRUC_SIMD=0 forces
+  // the scalar kernel
+  EdgeBlockKernel select_edge_block_kernel() {
+    const char* env = getenv("UNSTRUC_SIMD");
+    if (env && atoi(env) == 0)
+      return edge_block_scalar;
+#ifdef UNSTRUC_AVX_KERNEL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+      return edge_block_avx;
+#endif
+    return edge_block_scalar;
   }
 
-  size_t put_face_in_tree(std::unique_ptr<Octree>& tree, const Face& face) {
-    size_t n_added = 0;
-    std::bitset <8> overlap  ("11111111");
-
-    if (face.min.x > tree->center.x)
-      overlap &= ~x_bitset;
-    else if (face.max.x < tree->center.x)
-      overlap &= x_bitset;
-
-    if (face.min.y > tree->center.y)
-      overlap &= ~y_bitset;
-    else if (face.max.y < tree->center.y)
-      overlap &= y_bitset;
-
-    if (face.min.z > tree->center.z)
-      overlap &= ~z_bitset;
-    else if (face.max.z < tree->center.z)
-      overlap &= z_bitset;
-
-    for (size_t i = 0; i < 8; ++i) {
-      if (overlap[i]) {
-        if (tree->children[i]) {
-          n_added += put_face_in_tree(tree->children[i],face);
-        } else {
-          tree->faces[i].push_back(face);
-          n_added++;
-        }
+  // Calls f(face) for every face in the block that the edge crosses
+  template <typename F>
+  void edge_hits_block(const Edge& edge, const EdgeData& e, const FaceBlock& block, const std::vector<Face>& faces, F f) {
+    static const EdgeBlockKernel kernel = select_edge_block_kernel();
+    unsigned hits = kernel(e,block);
+    for (size_t s = 0; hits; ++s, hits >>= 1) {
+      if (!(hits & 1)) continue;
+      const Face& face = faces[block.faces[s]];
+      bool same = false;
+      for (Index p : face.points) {
+        if (edge.p1 == p || edge.p2 == p)
+          same = true;
       }
+      if (!same)
+        f(face);
     }
-    return n_added;
   }
 
-  struct IntersectionsBool {
-    std::vector<bool> points;
-    std::vector<bool> elements;
-  };
-
-  void check_intersections(const Grid& grid, const std::vector<Edge>& edges, const std::vector<Face>& faces, IntersectionsBool& intersections) {
-    for (size_t i = 0; i < edges.size(); ++i) {
-      const Edge& edge = edges[i];
-      const Point& ep1 = grid.points[edge.p1];
-      const Point& ep2 = grid.points[edge.p2];
-      Vector edge_vector = ep2 - ep1;
-      for (size_t j = 0; j < faces.size(); ++j) {
-        const Face& face = faces[j];
-
-        if (edge.min.x > face.max.x || edge.min.y > face.max.y || edge.min.z > face.max.z) continue;
-        if (edge.max.x < face.min.x || edge.max.y < face.min.y || edge.max.z < face.min.z) continue;
-
-        bool same = false;
-        for (size_t p : face.points) {
-          if (edge.p1 == p || edge.p2 == p)
-            same = true;
-          if (ep1 == grid.points[p] || ep2 == grid.points[p])
-            same = true;
-        }
-        if (same) continue;
-
-        double denom = dot(edge_vector,face.normal);
-        if (denom == 0) continue;
-        double scale = dot(ep1 - face.center,face.normal)/denom;
-
-        if (-1 <= scale && scale <= 0) {
-          Point proj = ep1 - edge_vector*scale;
-          bool intersected = true;
-          for (size_t k = 0; k < face.points.size(); ++k) {
-            const Point& p0 = grid.points[face.points[k]];
-            const Point& p1 = grid.points[face.points[(k+1)%face.points.size()]];
-            Vector v1 = p1 - p0;
-            Vector v2 = proj - p1;
-            Vector n = cross(v1,v2);
-            if (dot(n,face.normal) <= 0){
-              intersected = false;
-              break;
-            }
-          }
-          if (intersected) {
-            for (size_t _e : edge.elements)
-              intersections.elements[_e] = true;
-            for (size_t _e : face.elements)
-              intersections.elements[_e] = true;
-
-            intersections.points[edge.p1] = true;
-            intersections.points[edge.p2] = true;
-            for (size_t _p : face.points)
-              intersections.points[_p] = true;
-          }
-        }
+  // Builds a BVH over the faces with one face block per leaf
+  void build_face_tree(const Grid& grid, const std::vector<Face>& faces, BVH& tree, std::vector<FaceBlock>& blocks, std::vector<Index>& node_block) {
+    std::vector<Point> mins (faces.size());
+    std::vector<Point> maxs (faces.size());
+    for (size_t i = 0; i < faces.size(); ++i) {
+      mins[i] = faces[i].min;
+      maxs[i] = faces[i].max;
+    }
+    tree.build(mins,maxs,4);
+
+    node_block.assign(tree.nodes.size(),max_index);
+    size_t n_blocks = 0;
+    for (size_t i = 0; i < tree.nodes.size(); ++i) {
+      if (tree.nodes[i].n)
+        node_block[i] = n_blocks++;
+    }
+    blocks.resize(n_blocks);
+    parallel_for(tree.nodes.size(),[&](size_t i) {
+      const BVH::Node& node = tree.nodes[i];
+      if (!node.n) return;
+      FaceBlock& block = blocks[node_block[i]];
+      for (size_t s = 0; s < 4; ++s) {
+        if (s < node.n)
+          set_block_face(block,s,grid,faces,tree.primitives[node.first + s]);
+        else
+          clear_block_slot(block,s);
       }
-    }
+    });
   }
 
-  void _find_with_tree(const Grid& grid, const std::unique_ptr<Octree>& tree, IntersectionsBool& intersections) {
-    for (size_t i = 0; i < 8; ++i) {
-      if (tree->children[i])
-        _find_with_tree(grid, tree->children[i],intersections);
-      else
-        check_intersections(grid, tree->edges[i], tree->faces[i],intersections);
-    }
-  }
+  typedef std::pair<Index,Index> EdgeFaceHit;
 
-  struct IntersectionPair {
-    size_t p;
-    double dist;
-    bool intersected;
+  struct IntersectionTracker::Data {
+    std::vector <Point> points; // positions at the last update
+    bool first;
 
-    IntersectionPair() : p(0),dist(DBL_MAX),intersected(0) {};
-  };
-  typedef std::vector<IntersectionPair> IntersectionPairs;
+    std::vector <Edge> edges;
+    std::vector <Point> edge_mins, edge_maxs;
+    BVH edge_tree;
+    bool has_edge_tree;
+    std::vector <Index> edge_leaf;
 
-  void check_intersections(const Grid& grid, const std::vector<Edge>& edges, const std::vector<Face>& faces, IntersectionPairs& intersections) {
-    for (size_t i = 0; i < edges.size(); ++i) {
-      const Edge& edge = edges[i];
-      double min_dist = intersections[edge.p1].dist;
-      const Point& ep1 = grid.points[edge.p1];
-      const Point& ep2 = grid.points[edge.p2];
-      Vector edge_vector = ep2 - ep1;
-      for (size_t j = 0; j < faces.size(); ++j) {
-        const Face& face = faces[j];
+    std::vector <Face> faces;
+    std::vector <Point> face_mins, face_maxs;
+    BVH face_tree;
+    std::vector <FaceBlock> blocks;
+    std::vector <Index> node_block;
+    std::vector <Index> face_leaf;
+    std::vector <unsigned char> face_slot;
 
-        if (edge.min.x > face.max.x || edge.min.y > face.max.y || edge.min.z > face.max.z) continue;
-        if (edge.max.x < face.min.x || edge.max.y < face.min.y || edge.max.z < face.min.z) continue;
+    std::vector <EdgeFaceHit> hits; // sorted
+  };
 
-        bool same = false;
-        for (size_t p : face.points) {
-          if (edge.p1 == p || edge.p2 == p)
-            same = true;
-          if (ep1 == grid.points[p] || ep2 == grid.points[p])
-            same = true;
-        }
-        if (same) continue;
-
-        double denom = dot(edge_vector,face.normal);
-        if (denom == 0) continue;
-        double scale = dot(ep1 - face.center,face.normal)/denom;
-
-        if (-1 <= scale && scale <= 0) {
-          Point proj = ep1 - edge_vector*scale;
-          bool intersected = true;
-          for (size_t k = 0; k < face.points.size(); ++k) {
-            const Point& p0 = grid.points[face.points[k]];
-            const Point& p1 = grid.points[face.points[(k+1)%face.points.size()]];
-            Vector v1 = p1 - p0;
-            Vector v2 = proj - p1;
-            Vector n = cross(v1,v2);
-            if (dot(n,face.normal) <= 0){
-              intersected = false;
-              break;
-            }
-          }
-          if (intersected) {
-            for (size_t _p : face.points) {
-              const Point& fp = grid.points[_p];
-              double d = (fp - ep1).length();
-              if (d < min_dist) {
-                min_dist = d;
-                intersections[edge.p1].p = _p;
-                intersections[edge.p1].dist = d;
-                intersections[edge.p1].intersected = true;
-              }
-            }
-          }
-        }
+  IntersectionTracker::IntersectionTracker(const Grid& grid) : n_moved_points(0), data(new Data) {
+    Data& d = *data;
+    d.points = grid.points;
+    d.first = true;
+    d.has_edge_tree = false;
+
+    d.faces = get_faces(grid);
+    d.face_mins.resize(d.faces.size());
+    d.face_maxs.resize(d.faces.size());
+    for (size_t i = 0; i < d.faces.size(); ++i) {
+      d.face_mins[i] = d.faces[i].min;
+      d.face_maxs[i] = d.faces[i].max;
+    }
+    build_face_tree(grid,d.faces,d.face_tree,d.blocks,d.node_block);
+    d.face_leaf.resize(d.faces.size());
+    d.face_slot.resize(d.faces.size());
+    for (size_t i = 0; i < d.face_tree.nodes.size(); ++i) {
+      const BVH::Node& node = d.face_tree.nodes[i];
+      for (Index j = 0; j < node.n; ++j) {
+        d.face_leaf[d.face_tree.primitives[node.first + j]] = i;
+        d.face_slot[d.face_tree.primitives[node.first + j]] = j;
       }
     }
-  }
 
-  void _find_with_tree(const Grid& grid, const std::unique_ptr<Octree>& tree, IntersectionPairs& intersections) {
-    for (size_t i = 0; i < 8; ++i) {
-      if (tree->children[i])
-        _find_with_tree(grid, tree->children[i],intersections);
-      else
-        check_intersections(grid, tree->edges[i], tree->faces[i],intersections);
+    d.edges = get_edges(grid);
+    d.edge_mins.resize(d.edges.size());
+    d.edge_maxs.resize(d.edges.size());
+    for (size_t i = 0; i < d.edges.size(); ++i) {
+      d.edge_mins[i] = d.edges[i].min;
+      d.edge_maxs[i] = d.edges[i].max;
     }
   }
 
-  Intersections Intersections::find_with_octree(const Grid& grid) {
-    std::vector <Face> faces = get_faces(grid);
-    std::vector <Edge> edges = get_edges(grid);
+  IntersectionTracker::~IntersectionTracker() {}
 
-    auto tree = create_octree_root(grid);
+  // Returns the indices of the entries of flags that are set, in order
+  std::vector<Index> set_flags(const std::vector<unsigned char>& flags) {
+    std::vector<Index> list;
+    for (size_t i = 0; i < flags.size(); ++i) {
+      if (flags[i])
+        list.push_back(i);
+    }
+    return list;
+  }
 
-    size_t n_edges_added = 0;
-    for (const Edge& edge : edges)
-      n_edges_added += put_edge_in_tree(tree,edge);
+  // Hits involving a moved edge or face are dropped and found again. Moved
+  // edges are tested against all faces, and unmoved edges are tested against
+  // the moved faces, so every pair is tested by exactly one of them. The
+  // tests are the same as in a full check, so the result is identical
+  Intersections IntersectionTracker::update(const Grid& grid) {
+    Data& d = *data;
+    if (grid.points.size() != d.points.size())
+      fatal("(unstruc::IntersectionTracker::update) Grid does not match tracker");
+
+    std::vector <unsigned char> moved_points (grid.points.size());
+    parallel_for(grid.points.size(),[&](size_t i) {
+      moved_points[i] = !(grid.points[i] == d.points[i]);
+      if (moved_points[i])
+        d.points[i] = grid.points[i];
+    });
+    n_moved_points = 0;
+    for (unsigned char m : moved_points)
+      n_moved_points += m;
+
+    std::vector <unsigned char> moved_edges (d.edges.size());
+    parallel_for(d.edges.size(),[&](size_t i) {
+      const Edge& edge = d.edges[i];
+      moved_edges[i] = moved_points[edge.p1] || moved_points[edge.p2];
+    });
+    std::vector <unsigned char> moved_faces (d.faces.size());
+    parallel_for(d.faces.size(),[&](size_t i) {
+      for (Index p : d.faces[i].points) {
+        if (moved_points[p])
+          moved_faces[i] = 1;
+      }
+    });
+    std::vector <Index> edge_list = set_flags(moved_edges);
+    std::vector <Index> face_list = set_flags(moved_faces);
+
+    parallel_for(edge_list.size(),[&](size_t i) {
+      Edge& edge = d.edges[edge_list[i]];
+      set_edge_properties(grid,edge);
+      d.edge_mins[edge_list[i]] = edge.min;
+      d.edge_maxs[edge_list[i]] = edge.max;
+    });
+    parallel_for(face_list.size(),[&](size_t i) {
+      Face& face = d.faces[face_list[i]];
+      set_face_properties(grid,face);
+      d.face_mins[face_list[i]] = face.min;
+      d.face_maxs[face_list[i]] = face.max;
+    });
+
+    {
+      std::vector <Index> leaves (face_list.size());
+      for (size_t i = 0; i < face_list.size(); ++i)
+        leaves[i] = d.face_leaf[face_list[i]];
+      std::sort(leaves.begin(),leaves.end());
+      leaves.erase(std::unique(leaves.begin(),leaves.end()),leaves.end());
+      d.face_tree.refit_leaves(leaves,d.face_mins,d.face_maxs);
+      for (Index _f : face_list)
+        set_block_face(d.blocks[d.node_block[d.face_leaf[_f]]],d.face_slot[_f],grid,d.faces,_f);
+    }
+    if (d.has_edge_tree) {
+      std::vector <Index> leaves (edge_list.size());
+      for (size_t i = 0; i < edge_list.size(); ++i)
+        leaves[i] = d.edge_leaf[edge_list[i]];
+      std::sort(leaves.begin(),leaves.end());
+      leaves.erase(std::unique(leaves.begin(),leaves.end()),leaves.end());
+      d.edge_tree.refit_leaves(leaves,d.edge_mins,d.edge_maxs);
+    }
+
+    // The first update tests everything
+    if (d.first) {
+      std::fill(moved_edges.begin(),moved_edges.end(),1);
+      edge_list.resize(d.edges.size());
+      for (size_t i = 0; i < edge_list.size(); ++i)
+        edge_list[i] = i;
+      face_list.clear();
+    }
+
+    size_t n_kept = 0;
+    for (const EdgeFaceHit& hit : d.hits) {
+      if (!moved_edges[hit.first] && !moved_faces[hit.second])
+        d.hits[n_kept++] = hit;
+    }
+    d.hits.resize(n_kept);
+
+    size_t n_threads = get_n_threads();
+    std::vector< std::vector<EdgeFaceHit> > thread_hits (n_threads);
+
+    parallel_for_dynamic_n(edge_list.size(),n_threads,[&](size_t thread, size_t i) {
+      Index _e = edge_list[i];
+      const Edge& edge = d.edges[_e];
+      EdgeData e = edge_data(grid,edge);
+      d.face_tree.query_leaves(edge.min,edge.max,[&](Index i_node) {
+        edge_hits_block(edge,e,d.blocks[d.node_block[i_node]],d.faces,[&](const Face& face) {
+          thread_hits[thread].push_back(EdgeFaceHit(_e,&face - &d.faces[0]));
+        });
+      });
+    });
+
+    if (face_list.size() && edge_list.size() < d.edges.size()) {
+      if (!d.has_edge_tree) {
+        d.edge_tree.build(d.edge_mins,d.edge_maxs,4);
+        d.edge_leaf.resize(d.edges.size());
+        for (size_t i = 0; i < d.edge_tree.nodes.size(); ++i) {
+          const BVH::Node& node = d.edge_tree.nodes[i];
+          for (Index j = node.first; j < node.first + node.n; ++j)
+            d.edge_leaf[d.edge_tree.primitives[j]] = i;
+        }
+        d.has_edge_tree = true;
+      }
+      parallel_for_dynamic_n(face_list.size(),n_threads,[&](size_t thread, size_t i) {
+        Index _f = face_list[i];
+        const FaceBlock& block = d.blocks[d.node_block[d.face_leaf[_f]]];
+        d.edge_tree.query(d.face_mins[_f],d.face_maxs[_f],[&](Index _e) {
+          if (moved_edges[_e]) return;
+          const Edge& edge = d.edges[_e];
+          edge_hits_block(edge,edge_data(grid,edge),block,d.faces,[&](const Face& face) {
+            if (&face == &d.faces[_f])
+              thread_hits[thread].push_back(EdgeFaceHit(_e,_f));
+          });
+        });
+      });
+    }
+
+    for (const std::vector<EdgeFaceHit>& h : thread_hits)
+      d.hits.insert(d.hits.end(),h.begin(),h.end());
+    std::sort(d.hits.begin() + n_kept,d.hits.end());
+    std::inplace_merge(d.hits.begin(),d.hits.begin() + n_kept,d.hits.end());
+    d.first = false;
 
-    size_t n_faces_added = 0;
-    for (const Face& face : faces)
-      n_faces_added += put_face_in_tree(tree,face);
+    Intersections intersections;
+    for (const EdgeFaceHit& hit : d.hits) {
+      const Edge& edge = d.edges[hit.first];
+      const Face& face = d.faces[hit.second];
+      intersections.elements.insert(intersections.elements.end(),edge.elements.begin(),edge.elements.end());
+      intersections.elements.insert(intersections.elements.end(),face.elements.begin(),face.elements.end());
+      intersections.points.push_back(edge.p1);
+      intersections.points.push_back(edge.p2);
+      intersections.points.insert(intersections.points.end(),face.points.begin(),face.points.end());
+    }
+    std::sort(intersections.points.begin(),intersections.points.end());
+    intersections.points.erase(std::unique(intersections.points.begin(),intersections.points.end()),intersections.points.end());
+    std::sort(intersections.elements.begin(),intersections.elements.end());
+    intersections.elements.erase(std::unique(intersections.elements.begin(),intersections.elements.end()),intersections.elements.end());
+    return intersections;
+  }
 
-    IntersectionsBool intersections_octree;
-    intersections_octree.points.resize(grid.points.size(),false);
-    intersections_octree.elements.resize(grid.elements.size(),false);
-    _find_with_tree(grid, tree, intersections_octree);
+  Intersections Intersections::find_with_octree(const Grid& grid) {
+    IntersectionTracker tracker (grid);
+    return tracker.update(grid);
+  }
 
-    Intersections intersections;
-    for (size_t i = 0; i < intersections_octree.points.size(); ++i) {
-      if (intersections_octree.points[i])
-        intersections.points.push_back(i);
-    }
-    for (size_t i = 0; i < intersections_octree.elements.size(); ++i) {
-      if (intersections_octree.elements[i])
-        intersections.elements.push_back(i);
-    }
+  Intersections Intersections::find(const GridView& view) {
+    std::vector <Index> used_points = view.used_points();
+    Intersections intersections = find(view.compact());
+    for (Index& p : intersections.points)
+      p = used_points[p];
+    for (Index& e : intersections.elements)
+      e = view.element_index[e];
     return intersections;
   }
 
@@ -672,15 +795,24 @@ namespace unstruc {
     std::vector <Edge> edges = get_edges(grid);
     std::sort(edges.begin(),edges.end(),Edge::compare_by_min_x);
 
+    // Blocks of four consecutive faces. Faces outside the sweep window are
+    // rejected by the bounding box test in the kernel
+    std::vector <FaceBlock> blocks ((faces.size() + 3)/4);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      for (size_t s = 0; s < 4; ++s) {
+        if (4*i + s < faces.size())
+          set_block_face(blocks[i],s,grid,faces,4*i + s);
+        else
+          clear_block_slot(blocks[i],s);
+      }
+    }
+
     size_t j_current = 0;
     Intersections intersections;
     std::vector <bool> intersected_points (grid.points.size(),false);
     std::vector <bool> intersected_elements (grid.elements.size(),false);
     for (size_t i = 0; i < edges.size(); ++i) {
       const Edge& edge = edges[i];
-      const Point& ep1 = grid.points[edge.p1];
-      const Point& ep2 = grid.points[edge.p2];
-      Vector edge_vector = ep2 - ep1;
       for (size_t j = j_current; j < faces.size(); ++j) {
         const Face& face = faces[j];
         if (edge.min.x > face.max.x)
@@ -688,48 +820,20 @@ namespace unstruc {
         else
           break;
       }
-      for (size_t j = j_current; j < faces.size(); ++j) {
-        const Face& face = faces[j];
-        if (face.min.x > edge.max.x) break;
-        if (edge.min.x > face.max.x || edge.min.y > face.max.y || edge.min.z > face.max.z) continue;
-        if (edge.max.x < face.min.x || edge.max.y < face.min.y || edge.max.z < face.min.z) continue;
-        bool same = false;
-        for (size_t p : face.points) {
-          if (edge.p1 == p || edge.p2 == p)
-            same = true;
-          if (ep1 == grid.points[p] || ep2 == grid.points[p])
-            same = true;
-        }
-        if (same) continue;
-        double denom = dot(edge_vector,face.normal);
-        if (denom == 0) continue;
-        double scale = dot(ep1 - face.center,face.normal)/denom;
-        if (-1 <= scale && scale <= 0) {
-          Point proj = ep1 - edge_vector*scale;
-          bool intersected = true;
-          for (size_t k = 0; k < face.points.size(); ++k) {
-            const Point& p0 = grid.points[face.points[k]];
-            const Point& p1 = grid.points[face.points[(k+1)%face.points.size()]];
-            Vector v1 = p1 - p0;
-            Vector v2 = proj - p1;
-            Vector n = cross(v1,v2);
-            if (dot(n,face.normal) <= 0){
-              intersected = false;
-              break;
-            }
-          }
-          if (intersected) {
-            for (size_t _e : edge.elements)
-              intersected_elements[_e] = true;
-            for (size_t _e : face.elements)
-              intersected_elements[_e] = true;
-
-            intersected_points[edge.p1] = true;
-            intersected_points[edge.p2] = true;
-            for (size_t _p : face.points)
-              intersected_points[_p] = true;
-          }
-        }
+      EdgeData e = edge_data(grid,edge);
+      for (size_t b = j_current/4; b < blocks.size(); ++b) {
+        if (faces[4*b].min.x > edge.max.x) break;
+        edge_hits_block(edge,e,blocks[b],faces,[&](const Face& face) {
+          for (Index _e : edge.elements)
+            intersected_elements[_e] = true;
+          for (Index _e : face.elements)
+            intersected_elements[_e] = true;
+
+          intersected_points[edge.p1] = true;
+          intersected_points[edge.p2] = true;
+          for (Index _p : face.points)
+            intersected_points[_p] = true;
+        });
       }
     }
     for (size_t i = 0; i < intersected_points.size(); ++i) {
@@ -756,25 +860,32 @@ namespace unstruc {
     return distance*distance/(distance*distance + 50);
   }
 
+  // For every surface point, checks the edge from the point to its projected
+  // future position against the surface faces and pairs the point with the
+  // closest point of any face the edge crosses. Equally close points are
+  // resolved to the lowest index
   PointPairList Intersections::find_future(const Grid& surface, Grid offset) {
 
     std::vector <Face> faces = get_faces(surface);
 
-    auto tree = create_octree_root(surface);
-    for (const Face& face : faces)
-      put_face_in_tree(tree,face);
-
     size_t n_points = surface.points.size();
 
     Grid grid (surface);
     grid.points.resize(n_points*2);
-    for (size_t _p = 0; _p < n_points; _p++) {
-      const Point& surface_p = surface.points[_p];
-      const Point& offset_p = offset.points[_p];
+    parallel_for(n_points,[&](size_t _p) {
+      Vector n = offset.points[_p] - surface.points[_p];
+      grid.points[_p + n_points] = surface.points[_p] + future_factor*n;
+    });
 
-      Vector n = offset_p - surface_p;
-      Point future_p = surface_p + future_factor*n;
-      grid.points[_p + n_points] = future_p;
+    BVH tree;
+    std::vector <FaceBlock> blocks;
+    std::vector <Index> node_block;
+    build_face_tree(grid,faces,tree,blocks,node_block);
+
+    std::vector<Index> closest (n_points,max_index);
+    parallel_for_dynamic(n_points,[&](size_t, size_t _p) {
+      const Point& surface_p = grid.points[_p];
+      const Point& future_p = grid.points[_p + n_points];
 
       Edge edge (_p, _p + n_points);
       edge.min.x = std::min(surface_p.x, future_p.x);
@@ -783,23 +894,26 @@ namespace unstruc {
       edge.max.x = std::max(surface_p.x, future_p.x);
       edge.max.y = std::max(surface_p.y, future_p.y);
       edge.max.z = std::max(surface_p.z, future_p.z);
+      EdgeData e = edge_data(grid,edge);
+
+      double min_dist = DBL_MAX;
+      tree.query_leaves(edge.min,edge.max,[&](Index i_node) {
+        edge_hits_block(edge,e,blocks[node_block[i_node]],faces,[&](const Face& face) {
+          for (Index _fp : face.points) {
+            double d = (grid.points[_fp] - surface_p).length();
+            if (d < min_dist || (d == min_dist && _fp < closest[_p])) {
+              min_dist = d;
+              closest[_p] = _fp;
+            }
+          }
+        });
+      });
+    });
 
-      put_edge_in_tree(tree,edge);
-    }
-
-    IntersectionPairs intersections (n_points);
-    _find_with_tree(grid, tree, intersections);
-    size_t n_intersections = 0;
-    for (auto intersection : intersections)
-      if (intersection.intersected)
-        n_intersections++;
     PointPairList intersection_list;
-    intersection_list.reserve(n_intersections);
     for (size_t _p = 0; _p < n_points; ++_p) {
-      if (intersections[_p].intersected) {
-        size_t _p2 = intersections[_p].p;
-        intersection_list.push_back( std::make_pair (_p,_p2) );
-      }
+      if (closest[_p] != max_index)
+        intersection_list.push_back( std::make_pair (Index(_p),closest[_p]) );
     }
     return intersection_list;
   }
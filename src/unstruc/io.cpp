@@ -5,10 +5,13 @@
 #include "gmsh.h"
 #include "stl.h"
 #include "vtk.h"
+#include "vtu.h"
 #include "cgns.h"
 
 #include "grid.h"
+#include "gridview.h"
 #include "error.h"
+#include "parallel.h"
 
 namespace unstruc {
 
@@ -22,6 +25,10 @@ namespace unstruc {
       return FileType::STLB;
     else if (n > 4 && filename.compare(n-4,4,".vtk") == 0)
       return FileType::VTK;
+    else if (n > 4 && filename.compare(n-4,4,".vtu") == 0)
+      return FileType::VTU;
+    else if (n > 5 && filename.compare(n-5,5,".pvtu") == 0)
+      return FileType::PVTU;
     else if (n > 5 && filename.compare(n-5,5,".cgns") == 0)
       return FileType::CGNS2;
     else if (n > 4 && (filename.compare(n-4,4,".xyz") == 0 || filename.compare(n-4,4,".p3d") == 0))
@@ -53,6 +60,10 @@ namespace unstruc {
     return Grid();
   }
 
+  void write_grid(const std::string& filename,const GridView& view) {
+    write_grid(filename,view.compact());
+  }
+
   void write_grid(const std::string& filename,const Grid& grid) {
     if (!grid.check_integrity())
       fatal("Grid integrity check failed");
@@ -66,6 +77,12 @@ namespace unstruc {
     case FileType::VTK:
       vtk_write(filename,grid);
       break;
+    case FileType::VTU:
+      vtu_write(filename,grid);
+      break;
+    case FileType::PVTU:
+      pvtu_write(filename,grid,get_n_threads());
+      break;
     case FileType::GMSH:
       gmsh_write(filename,grid);
       break;
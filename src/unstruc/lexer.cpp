@@ -0,0 +1,197 @@
+#include "lexer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace unstruc {
+
+  namespace {
+    const double exact_powers_of_ten[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+#ifdef __SIZEOF_INT128__
+    typedef unsigned __int128 uint128;
+
+    const int min_eisel_lemire_exponent = -27;
+    const int max_eisel_lemire_exponent = 55;
+
+    // 5^q scaled so the top of 128 bits is set. The positive powers fit
+    // exactly and the negative ones are rounded up, as Eisel-Lemire expects
+    struct PowersOfFive {
+      uint128 values[max_eisel_lemire_exponent - min_eisel_lemire_exponent + 1];
+
+      PowersOfFive() {
+        for (int q = 0; q <= max_eisel_lemire_exponent; ++q) {
+          uint128 p = 1;
+          for (int k = 0; k < q; ++k)
+            p *= 5;
+          while (!(p >> 127))
+            p <<= 1;
+          values[q - min_eisel_lemire_exponent] = p;
+        }
+        for (int q = -1; q >= min_eisel_lemire_exponent; --q) {
+          uint64_t d = 1;
+          for (int k = 0; k < -q; ++k)
+            d *= 5;
+          int z = 0;
+          while ((uint64_t(1) << z) < d)
+            ++z;
+          // 2^(z+127)/d by long division
+          uint128 quotient = 0;
+          uint128 remainder = 0;
+          for (int bit = z + 127; bit >= 0; --bit) {
+            remainder = 2*remainder + (bit == z + 127);
+            quotient <<= 1;
+            if (remainder >= d) {
+              remainder -= d;
+              quotient |= 1;
+            }
+          }
+          values[q - min_eisel_lemire_exponent] = quotient + 1;
+        }
+      };
+    };
+
+    // w*10^q for a w of up to 19 digits. The top bits of the product with a
+    // truncated power of five give the double directly, apart from
+    // subnormals and overflow, which are left to strtod
+    bool parse_double_eisel_lemire(uint64_t w, int q, double& v) {
+      if (q < min_eisel_lemire_exponent || q > max_eisel_lemire_exponent) return false;
+      static const PowersOfFive powers;
+      uint128 power = powers.values[q - min_eisel_lemire_exponent];
+
+      int lz = __builtin_clzll(w);
+      w <<= lz;
+      uint128 first = uint128(w)*uint64_t(power >> 64);
+      uint64_t hi = uint64_t(first >> 64);
+      uint64_t lo = uint64_t(first);
+      const uint64_t precision_mask = UINT64_MAX >> 55;
+      if ((hi & precision_mask) == precision_mask) {
+        uint64_t second_hi = uint64_t((uint128(w)*uint64_t(power)) >> 64);
+        lo += second_hi;
+        if (second_hi > lo) ++hi;
+      }
+
+      int upperbit = int(hi >> 63);
+      int shift = upperbit + 64 - 52 - 3;
+      uint64_t mantissa = hi >> shift;
+      int power2 = (((152170 + 65536)*q) >> 16) + 63 + upperbit - lz + 1023;
+      if (power2 <= 0) return false;
+      // Exactly halfway between two doubles rounds to even
+      if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 && (mantissa << shift) == hi)
+        mantissa &= ~uint64_t(1);
+      mantissa += mantissa & 1;
+      mantissa >>= 1;
+      if (mantissa >= (uint64_t(2) << 52)) {
+        mantissa = uint64_t(1) << 52;
+        ++power2;
+      }
+      mantissa &= ~(uint64_t(1) << 52);
+      if (power2 >= 0x7ff) return false;
+      uint64_t bits = mantissa | (uint64_t(power2) << 52);
+      memcpy(&v,&bits,sizeof(v));
+      return true;
+    }
+#else
+    bool parse_double_eisel_lemire(uint64_t, int, double&) {
+      return false;
+    }
+#endif
+
+    // strtod needs a terminated string, which fits on the stack for any
+    // reasonable number
+    bool parse_double_strtod(const char* begin, const char* end, double& v) {
+      char buffer[64];
+      size_t n = end - begin;
+      if (n >= sizeof(buffer)) {
+        std::string s (begin,end);
+        char* last;
+        v = strtod(s.c_str(),&last);
+        return last == s.c_str() + s.size();
+      }
+      memcpy(buffer,begin,n);
+      buffer[n] = '\0';
+      char* last;
+      v = strtod(buffer,&last);
+      return last == buffer + n;
+    }
+  }
+
+  // A mantissa of at most 2^53 and a power of ten up to 10^22 are both exact
+  // doubles, so a single multiply or divide rounds correctly. Longer
+  // mantissas, like those written with %.17g, use Eisel-Lemire where it
+  // applies. Everything else goes to strtod
+  bool parse_double(const char* begin, const char* end, double& v) {
+    const char* p = begin;
+    if (p == end) return false;
+    bool negative = (*p == '-');
+    if (*p == '-' || *p == '+') ++p;
+
+    uint64_t mantissa = 0;
+    int n_digits = 0;
+    int n_significant = 0;
+    int exponent = 0;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p, ++n_digits) {
+      if (mantissa == 0 && *p == '0') continue;
+      if (++n_significant > 19) return parse_double_strtod(begin,end,v);
+      mantissa = 10*mantissa + (*p - '0');
+    }
+    if (p != end && *p == '.') {
+      for (++p; p != end && *p >= '0' && *p <= '9'; ++p, ++n_digits) {
+        exponent--;
+        if (mantissa == 0 && *p == '0') continue;
+        if (++n_significant > 19) return parse_double_strtod(begin,end,v);
+        mantissa = 10*mantissa + (*p - '0');
+      }
+    }
+    if (n_digits == 0) return parse_double_strtod(begin,end,v);
+    if (p != end && (*p == 'e' || *p == 'E')) {
+      ++p;
+      bool negative_exponent = (p != end && *p == '-');
+      if (p != end && (*p == '-' || *p == '+')) ++p;
+      if (p == end) return false;
+      int e = 0;
+      for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+        if (e > 10000) return parse_double_strtod(begin,end,v);
+        e = 10*e + (*p - '0');
+      }
+      exponent += negative_exponent ? -e : e;
+    }
+    if (p != end) return false;
+
+    if (mantissa > (uint64_t(1) << 53) || exponent < -22 || exponent > 22) {
+      double d;
+      if (mantissa == 0 || !parse_double_eisel_lemire(mantissa,exponent,d))
+        return parse_double_strtod(begin,end,v);
+      v = negative ? -d : d;
+      return true;
+    }
+    double d = double(mantissa);
+    if (exponent < 0)
+      d /= exact_powers_of_ten[-exponent];
+    else
+      d *= exact_powers_of_ten[exponent];
+    v = negative ? -d : d;
+    return true;
+  }
+
+  bool parse_integer(const char* begin, const char* end, int64_t& v) {
+    const char* p = begin;
+    if (p == end) return false;
+    bool negative = (*p == '-');
+    if (*p == '-' || *p == '+') ++p;
+    if (p == end) return false;
+    uint64_t u = 0;
+    for (; p != end; ++p) {
+      if (*p < '0' || *p > '9') return false;
+      if (u > (uint64_t(INT64_MAX) - 9)/10) return false;
+      u = 10*u + (*p - '0');
+    }
+    v = negative ? -int64_t(u) : int64_t(u);
+    return true;
+  }
+
+} //namespace unstruc
@@ -0,0 +1,56 @@
+#include "mappedfile.h"
+
+#include "error.h"
+
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace unstruc {
+
+  MappedFile::MappedFile(const std::string& filename) : data(nullptr), size(0), mapping(nullptr) {
+#ifndef _WIN32
+    int fd = open(filename.c_str(),O_RDONLY);
+    if (fd < 0) fatal("Could not open file");
+    struct stat st;
+    if (fstat(fd,&st) != 0) {
+      close(fd);
+      fatal("Could not open file");
+    }
+    size = st.st_size;
+    if (size > 0) {
+      void* p = mmap(nullptr,size,PROT_READ,MAP_PRIVATE,fd,0);
+      if (p != MAP_FAILED) {
+        madvise(p,size,MADV_SEQUENTIAL);
+        mapping = p;
+        data = static_cast<const char*>(p);
+      }
+    }
+    close(fd);
+    if (mapping || size == 0) return;
+#endif
+    // Fall back to reading the whole file
+    std::ifstream f (filename, std::ifstream::in | std::ifstream::binary);
+    if (!f.is_open()) fatal("Could not open file");
+    f.seekg(0,std::ios::end);
+    size = f.tellg();
+    f.seekg(0,std::ios::beg);
+    buffer.resize(size);
+    if (size > 0 && !f.read(buffer.data(),size))
+      fatal("Could not read file");
+    data = buffer.data();
+  }
+
+  MappedFile::~MappedFile() {
+#ifndef _WIN32
+    if (mapping)
+      munmap(mapping,size);
+#endif
+  }
+
+} //namespace unstruc
@@ -38,6 +38,8 @@ namespace unstruc {
     std::string object;
     std::string note;
     std::string filename;
+    size_t label_bits;
+    FoamHeader() : label_bits(64) {};
   };
 
   struct OFBoundary {
@@ -53,7 +55,7 @@ namespace unstruc {
     bool center_id_assigned;
     size_t face_center_id;
     double area;
-    std::vector<size_t> points;
+    std::vector<Index> points;
     Vector normal;
     Point center;
     std::vector<OFFace> split_faces;
@@ -81,7 +83,7 @@ namespace unstruc {
     }
     if (n_large_angles == 0) return 0;
 
-    std::vector<size_t> new_points;
+    std::vector<Index> new_points;
     if (face.points.size() - n_large_angles < 3) {
       fatal("angles");
     } else {
@@ -336,12 +338,11 @@ namespace unstruc {
     return height/length;
   }
 
-  void createElementsFromFaceCenter(OFFace& face, bool faces_out, size_t center_id, std::vector<Element>& new_elements) {
+  void createElementsFromFaceCenter(OFFace& face, bool faces_out, size_t center_id, ElementList& new_elements) {
     assert (face.points.size() > 2);
     if (face.points.size() == 3 && !face.is_tri_split) {
       // If current face only has 3 points, create a tetrahedral with face plus cell center
-      Element e (Shape::Tetra);
-      e.name_i = 0;
+      ElementRef e = new_elements.emplace_back(Shape::Tetra);
 
       if (faces_out) {
         e.points[2] = face.points[0];
@@ -353,10 +354,9 @@ namespace unstruc {
         e.points[2] = face.points[2];
       }
       e.points[3] = center_id;
-      new_elements.push_back(e);
     } else if (face.points.size() == 4 && !face.is_tri_split) {
       // If current face only has 4 points, create a pyramid with face plus cell center
-      Element e (Shape::Pyramid);
+      ElementRef e = new_elements.emplace_back(Shape::Pyramid);
 
       if (faces_out) {
         e.points[3] = face.points[0];
@@ -370,7 +370,6 @@ namespace unstruc {
         e.points[3] = face.points[3];
       }
       e.points[4] = center_id;
-      new_elements.push_back(e);
     } else {
       assert (face.split_faces.size());
       for (OFFace& new_face : face.split_faces) {
@@ -378,7 +377,7 @@ namespace unstruc {
       }
     }
   }
-  bool createWedgeElementsFromSideFace(Grid& grid, OFFace* side_face, OFFace* main_face, OFFace* opp_face, bool side_faces_out, size_t main_face_center_id, size_t opp_face_center_id, std::vector<Element>& new_elements) {
+  bool createWedgeElementsFromSideFace(Grid& grid, OFFace* side_face, OFFace* main_face, OFFace* opp_face, bool side_faces_out, size_t main_face_center_id, size_t opp_face_center_id, ElementList& new_elements) {
     std::vector<bool> pt_on_main_face(side_face->points.size());
     size_t n_on_main_face = 0;
     for (size_t _p = 0; _p < side_face->points.size(); ++_p) {
@@ -615,8 +614,7 @@ namespace unstruc {
           order[3] = 0;
         }
       }
-      new_elements.push_back( Element(Shape::Wedge) );
-      Element& e = new_elements.back();
+      ElementRef e = new_elements.emplace_back(Shape::Wedge);
       e.points[0] = main_face_center_id;
       e.points[1] = side_face->points[order[0]];
       e.points[2] = side_face->points[order[1]];
@@ -677,6 +675,14 @@ namespace unstruc {
         std::getline(f,token,';');
         token.erase(0,token.find_first_not_of(' '));
         header.note = token;
+      } else if (token == "arch") {
+        // e.g. "LSB;label=32;scalar=64". Without it labels are assumed to be 64 bit
+        std::getline(f,token,'"');
+        std::getline(f,token,'"');
+        size_t i = token.find("label=");
+        if (i != std::string::npos)
+          header.label_bits = atoi(token.substr(i+6).c_str());
+        std::getline(f,token,';');
       } else {
         std::cerr << token << std::endl;
         fatal("Not a valid FoamFile");
@@ -723,6 +729,22 @@ namespace unstruc {
     return vec;
   }
 
+  std::vector<Index> readLabels(std::ifstream& f, FoamHeader& header) {
+    std::vector<Index> labels;
+    if (header.label_bits == 32) {
+      std::vector<int32_t> vec = readBinary<int32_t>(f,header);
+      labels.assign(vec.begin(),vec.end());
+    } else if (header.label_bits == 64) {
+      std::vector<int64_t> vec = readBinary<int64_t>(f,header);
+      for (int64_t label : vec)
+        check_index_range(label);
+      labels.assign(vec.begin(),vec.end());
+    } else {
+      fatal("Invalid FoamFile: Unsupported label size in "+header.filename);
+    }
+    return labels;
+  }
+
   OFInfo readInfoFromOwners(const std::string& polymesh) {
     std::string filepath = polymesh + "/owner";
 
@@ -788,7 +810,7 @@ namespace unstruc {
     return info;
   }
 
-  std::vector<size_t> readOwners(const std::string polymesh) {
+  std::vector<Index> readOwners(const std::string polymesh) {
     std::string filepath = polymesh + "/owner";
 
     std::ifstream f;
@@ -798,10 +820,10 @@ namespace unstruc {
 
     if (header.format == "ascii") fatal("ascii not supported");
 
-    return readBinary<size_t>(f,header);
+    return readLabels(f,header);
   }
 
-  std::vector<size_t> readNeighbours(const std::string& polymesh) {
+  std::vector<Index> readNeighbours(const std::string& polymesh) {
     std::string filepath = polymesh + "/neighbour";
 
     std::ifstream f;
@@ -811,7 +833,7 @@ namespace unstruc {
 
     if (header.format == "ascii") fatal("ascii not supported");
 
-    return readBinary<size_t>(f,header);
+    return readLabels(f,header);
   }
 
   std::vector<Point> readPoints(const std::string& polymesh) {
@@ -838,12 +860,12 @@ namespace unstruc {
     if (header.format == "ascii") fatal("ascii not supported");
 
     std::vector<OFFace> faces;
-    std::vector<size_t> index = readBinary<size_t>(f,header);
-    std::vector<size_t> points = readBinary<size_t>(f,header);
+    std::vector<Index> index = readLabels(f,header);
+    std::vector<Index> points = readLabels(f,header);
 
     faces.resize(index.size() - 1);
     for (size_t i = 0; i < index.size() - 1; ++i)
-      faces[i].points = std::vector<size_t> (&points[index[i]],&points[index[i+1]]);
+      faces[i].points.assign(points.begin() + index[i],points.begin() + index[i+1]);
 
     return faces;
   }
@@ -873,10 +895,12 @@ namespace unstruc {
       if (token != "{") fatal("Invalid FoamFile: Expected '{' in "+header.location);
       while (token != "}") {
         if (token == "nFaces") {
+          found_n_faces = true;
           std::getline(f,token,';');
           token.erase(0,token.find_first_not_of(' '));
           boundaries[i].n_faces = atoi(token.c_str());
         } else if (token == "startFace") {
+          found_start_face = true;
           std::getline(f,token,';');
           token.erase(0,token.find_first_not_of(' '));
           boundaries[i].start_face = atoi(token.c_str());
@@ -961,12 +985,13 @@ namespace unstruc {
     OFInfo info = readInfoFromOwners(polymesh);
     grid.points = readPoints(polymesh);
     std::vector<OFFace> faces = readFaces(polymesh);
-    std::vector<size_t> owners = readOwners(polymesh);
-    std::vector<size_t> neighbours = readNeighbours(polymesh);
+    std::vector<Index> owners = readOwners(polymesh);
+    std::vector<Index> neighbours = readNeighbours(polymesh);
     std::vector<OFBoundary> boundaries = readBoundaries(polymesh);
 
     printf("Points: %d\nFaces: %d\nInternal Faces: %d\nCells: %d\n",info.n_points,info.n_faces,info.n_internal_faces,info.n_cells);
     if (info.n_points != grid.points.size()) fatal("Invalid FoamFile: number of points do not match");
+    check_index_range(info.n_points + info.n_faces + info.n_cells);
 
     int default_name = 0;
     if (info.n_faces != faces.size() ) fatal("Invalid FoamFile: number of faces do not match");
@@ -1006,22 +1031,22 @@ namespace unstruc {
       if (cell_type != OFPoly) continue;
 
       // Find complete set of points that make up cell by doing repeated unions
-      std::vector<size_t> point_set (0);
+      std::vector<Index> point_set (0);
       std::sort(point_set.begin(),point_set.end());
 
       for (OFFace* face : cell_faces) {
 
         // create vector of points for current face
-        std::vector<size_t> current_set (face->points);
+        std::vector<Index> current_set (face->points);
         std::sort(current_set.begin(),current_set.end());
 
         // copy point_set to temp_set so that final union goes back in point_set
-        std::vector<size_t> temp_set (point_set);
+        std::vector<Index> temp_set (point_set);
 
         // add space for union to add new values to point_set
         point_set.resize(current_set.size() + temp_set.size());
 
-        std::vector<size_t>::iterator it;
+        std::vector<Index>::iterator it;
         it = std::set_union(temp_set.begin(),temp_set.end(),current_set.begin(),current_set.end(),point_set.begin());
         point_set.resize(it-point_set.begin());
       }
@@ -1064,13 +1089,13 @@ namespace unstruc {
               grid.points.push_back(other_face->center);
             }
 
-            std::vector<Element> new_elements;
+            ElementList new_elements;
             for (size_t l = 0; l < cell_faces.size(); ++l) {
               if (l == j || l == k) continue;
               OFFace* side_face = cell_faces[l];
               bool side_faces_out = (l < n_owners_per_cell[i]);
               bool success = createWedgeElementsFromSideFace(grid,side_face,face,other_face,side_faces_out,face_center_id,other_face_center_id,new_elements);
-              for (Element& e : new_elements) {
+              for (ConstElementRef e : new_elements) {
                 if (e.calc_volume(grid) < -1e-3)
                   fatal("Large negative volume");
                 if (e.calc_volume(grid) < 0)
@@ -1103,7 +1128,7 @@ namespace unstruc {
 
               processed_cells[i] = true;
               n_wedge_split++;
-              grid.elements.insert(grid.elements.end(),new_elements.begin(),new_elements.end());
+              grid.elements.append(new_elements);
               break;
             } else {
               //Delete unused face centers from grid
@@ -1143,8 +1168,7 @@ namespace unstruc {
       }
 
       if (cell_type == OFTetra) {
-        grid.elements.push_back( Element(Shape::Tetra) );
-        Element& e = grid.elements.back();
+        ElementRef e = grid.elements.emplace_back(Shape::Tetra);
         e.name_i = default_name;
         bool faces_out = (n_owners_per_cell[i] > 0);
 
@@ -1255,8 +1279,7 @@ namespace unstruc {
         //	}
         //	e2.points[3] = extra_point;
       } else if (cell_type == OFPyramid) {
-        grid.elements.push_back( Element(Shape::Pyramid) );
-        Element& e = grid.elements.back();
+        ElementRef e = grid.elements.emplace_back(Shape::Pyramid);
         e.name_i = default_name;
         size_t quad_j = -1;
         bool found_quad_j;
@@ -1469,8 +1492,7 @@ namespace unstruc {
             tri2_points_aligned[missing_k] = tri2_p;
         }
 
-        grid.elements.push_back( Element(Shape::Wedge) );
-        Element& e = grid.elements.back();
+        ElementRef e = grid.elements.emplace_back(Shape::Wedge);
         e.name_i = default_name;
         if (tri1_faces_out) {
           e.points[0] = tri1_face->points[0];
@@ -1488,8 +1510,7 @@ namespace unstruc {
           e.points[3] = tri2_points_aligned[2];
         }
       } else if (cell_type == OFHexa) {
-        grid.elements.push_back( Element(Shape::Hexa) );
-        Element& e = grid.elements.back();
+        ElementRef e = grid.elements.emplace_back(Shape::Hexa);
         e.name_i = default_name;
         bool faces_out = (n_owners_per_cell[i] > 0);
         OFFace* first_face = cell_faces[0];
@@ -1557,10 +1578,10 @@ namespace unstruc {
     size_t negative_wedges = 0;
     size_t negative_tetras = 0;
     size_t negative_pyramids = 0;
-    for (Element& e : grid.elements) {
+    for (ElementRef e : grid.elements) {
       if (e.calc_volume(grid) < 0) {
         negative_volumes++;
-        negative_elements.push_back(e);
+        negative_elements.push_back(Element(e));
         if (e.type == Shape::Hexa)
           negative_hexas++;
         else if (e.type == Shape::Wedge)
@@ -1590,14 +1611,12 @@ namespace unstruc {
         OFFace& face = faces[i];
         if (face.points.size() < 3) fatal("1D Boundary Element Found");
         if (face.points.size() == 3 && !face.is_tri_split) {
-          grid.elements.push_back( Element(Shape::Triangle) );
-          Element &e = grid.elements.back();
+          ElementRef e = grid.elements.emplace_back(Shape::Triangle);
           e.name_i = name_i;
           for (size_t j = 0; j < 3; ++j)
             e.points[j] = face.points[j];
         } else if (face.points.size() == 4 && !face.is_tri_split) {
-          grid.elements.push_back( Element(Shape::Quad) );
-          Element &e = grid.elements.back();
+          ElementRef e = grid.elements.emplace_back(Shape::Quad);
           e.name_i = name_i;
           for (size_t j = 0; j < 4; ++j)
             e.points[j] = face.points[j];
@@ -1605,14 +1624,12 @@ namespace unstruc {
           assert (face.split_faces.size());
           for (OFFace& new_face : face.split_faces) {
             if (new_face.points.size() == 3) {
-              grid.elements.push_back( Element(Shape::Triangle) );
-              Element &e = grid.elements.back();
+              ElementRef e = grid.elements.emplace_back(Shape::Triangle);
               e.name_i = name_i;
               for (size_t j = 0; j < 3; ++j)
                 e.points[j] = new_face.points[j];
             } else if (new_face.points.size() == 4) {
-              grid.elements.push_back( Element(Shape::Quad) );
-              Element &e = grid.elements.back();
+              ElementRef e = grid.elements.emplace_back(Shape::Quad);
               e.name_i = name_i;
               for (size_t j = 0; j < 4; ++j)
                 e.points[j] = new_face.points[j];
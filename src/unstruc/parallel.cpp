@@ -0,0 +1,34 @@
+#include "parallel.h"
+
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+
+namespace unstruc {
+
+  namespace {
+    size_t default_n_threads() {
+      const char* env = getenv("UNSTRUC_NUM_THREADS");
+      if (env && atoi(env) > 0)
+        return atoi(env);
+      size_t n = std::thread::hardware_concurrency();
+      return n > 0 ? n : 1;
+    }
+
+    // Zero until set_n_threads is called. Atomic, since the parallel
+    // algorithms may be called from several threads at once
+    std::atomic<size_t> n_threads (0);
+  }
+
+  size_t get_n_threads() {
+    size_t n = n_threads.load(std::memory_order_relaxed);
+    if (n > 0) return n;
+    static const size_t n_default = default_n_threads();
+    return n_default;
+  }
+
+  void set_n_threads(size_t n) {
+    n_threads.store(n,std::memory_order_relaxed);
+  }
+
+} //namespace unstruc
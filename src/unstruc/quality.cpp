@@ -3,13 +3,14 @@
 #include <utility>
 
 #include "grid.h"
+#include "gridview.h"
 #include "io.h"
 #include "point.h"
 #include "error.h"
 
 namespace unstruc {
 
-  MinMax get_minmax_face_angle(const Grid& grid, const Element& e) {
+  MinMax get_minmax_face_angle(const Grid& grid, ConstElementRef e) {
     MinMax minmax { 180, 0 };
     switch (e.type) {
     case Shape::Triangle:
@@ -129,7 +130,7 @@ namespace unstruc {
     return minmax;
   }
 
-  MinMax get_minmax_dihedral_angle(const Grid& grid, const Element& e) {
+  MinMax get_minmax_dihedral_angle(const Grid& grid, ConstElementRef e) {
     MinMax minmax { 180, 0 };
     switch (e.type) {
     case Shape::Triangle:
@@ -214,24 +215,39 @@ namespace unstruc {
     return minmax;
   }
 
-  MeshQuality get_mesh_quality(const Grid& grid, double threshold) {
+  MeshQuality init_mesh_quality() {
     MeshQuality quality;
     quality.face_angle.min = 180;
     quality.face_angle.max = 0;
     quality.dihedral_angle.min = 180;
     quality.dihedral_angle.max = 0;
-    for (size_t i = 0; i < grid.elements.size(); ++i) {
-      const Element& e = grid.elements[i];
+    return quality;
+  }
 
-      MinMax f = get_minmax_face_angle(grid,e);
-      quality.face_angle.update(f);
+  void update_mesh_quality(MeshQuality& quality, const Grid& grid, Index i, double threshold) {
+    ConstElementRef e = grid.elements[i];
 
-      MinMax d = get_minmax_dihedral_angle(grid,e);
-      quality.dihedral_angle.update(d);
+    MinMax f = get_minmax_face_angle(grid,e);
+    quality.face_angle.update(f);
 
-      if (d.min < threshold || d.max > 180 - threshold || f.min < threshold || f.max > 180 - threshold)
-        quality.bad_elements.push_back(i);
-    }
+    MinMax d = get_minmax_dihedral_angle(grid,e);
+    quality.dihedral_angle.update(d);
+
+    if (d.min < threshold || d.max > 180 - threshold || f.min < threshold || f.max > 180 - threshold)
+      quality.bad_elements.push_back(i);
+  }
+
+  MeshQuality get_mesh_quality(const Grid& grid, double threshold) {
+    MeshQuality quality = init_mesh_quality();
+    for (size_t i = 0; i < grid.elements.size(); ++i)
+      update_mesh_quality(quality,grid,i,threshold);
+    return quality;
+  }
+
+  MeshQuality get_mesh_quality(const GridView& view, double threshold) {
+    MeshQuality quality = init_mesh_quality();
+    for (Index i : view.element_index)
+      update_mesh_quality(quality,view.grid,i,threshold);
     return quality;
   }
 
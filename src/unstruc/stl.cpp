@@ -3,6 +3,9 @@
 #include "element.h"
 #include "point.h"
 #include "error.h"
+#include "mappedfile.h"
+#include "parallel.h"
+#include "lexer.h"
 
 #include <cfloat>
 #include <iostream>
@@ -10,143 +13,308 @@
 #include <sstream>
 #include <array>
 #include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
 
 namespace unstruc {
 
-  Point stl_read_vertex_ascii(std::istream& ss) {
-    Point p;
-    std::string token;
-    ss >> token;
-    if (token != "vertex") fatal("Expected vertex");
-    ss >> p.x;
-    ss >> p.y;
-    ss >> p.z;
-    return p;
+  namespace {
+    // Points read from one chunk of an ASCII file, and whether the chunk
+    // ended inside a solid
+    struct StlAsciiChunk {
+      std::vector <Point> points;
+      bool in_solid;
+      std::string error;
+      StlAsciiChunk() : in_solid(false) {};
+    };
+
+    bool stl_read_vertex_ascii(Lexer& lex, Point& p, std::string& error) {
+      if (lex.next() != "vertex") {
+        error = "Expected vertex";
+        return false;
+      }
+      if (!lex.next_double(p.x) || !lex.next_double(p.y) || !lex.next_double(p.z)) {
+        error = "Expected number in vertex";
+        return false;
+      }
+      return true;
+    }
+
+    // The name of a solid is the rest of its line, unless the first facet
+    // follows on the same line
+    void stl_parse_ascii(const char* begin, const char* end, StlAsciiChunk& chunk) {
+      Lexer lex (begin,end);
+      bool& in_solid = chunk.in_solid;
+      std::string& error = chunk.error;
+      while (true) {
+        Token token = lex.next();
+        if (token.empty()) break;
+        if (token == "solid") {
+          const char* curr = lex.p;
+          Token name = lex.rest_of_line();
+          if (Lexer(name.begin,name.end).next() == "facet")
+            lex.p = curr;
+          in_solid = true;
+        } else if (token == "endsolid") {
+          lex.rest_of_line();
+          in_solid = false;
+        } else if (in_solid && token == "facet") {
+          if (lex.next() != "normal") {
+            error = "Expected normal after facet";
+            return;
+          }
+          Vector normal;
+          if (!lex.next_double(normal.x) || !lex.next_double(normal.y) || !lex.next_double(normal.z)) {
+            error = "Expected number in normal";
+            return;
+          }
+          if (lex.next() != "outer") {
+            error = "Expected outer after normal definition";
+            return;
+          }
+          if (lex.next() != "loop") {
+            error = "Expected loop after outer";
+            return;
+          }
+          Point p[3];
+          for (size_t i = 0; i < 3; ++i) {
+            if (!stl_read_vertex_ascii(lex,p[i],error))
+              return;
+          }
+          chunk.points.insert(chunk.points.end(),p,p+3);
+          if (lex.next() != "endloop") {
+            error = "Expected endloop";
+            return;
+          }
+          if (lex.next() != "endfacet") {
+            error = "Expected endfacet";
+            return;
+          }
+        } else {
+          char c_msg[100];
+          snprintf(c_msg,100,"Unknown Token '%s'",token.str().c_str());
+          error = c_msg;
+          return;
+        }
+      }
+    }
+
+    // Start of the first line at or after p that begins with a facet
+    const char* stl_next_facet(const char* p, const char* end) {
+      while (p != end && *p != '\n')
+        ++p;
+      while (p != end) {
+        Lexer lex (p,end);
+        lex.skip_whitespace();
+        const char* line = lex.p;
+        if (lex.next() == "facet")
+          return line;
+        p = lex.p;
+        while (p != end && *p != '\n')
+          ++p;
+      }
+      return end;
+    }
   }
 
+  // The file is split into chunks that start at facet lines and parsed in
+  // parallel. A chunk other than the first starts inside a solid, which is
+  // checked afterwards against the end of the last non-empty chunk before it
   Grid stl_read_ascii(const std::string& filename) {
     fprintf(stderr,"Reading ASCII STL File '%s'\n",filename.c_str());
-    Grid grid (3);
-    grid.names.push_back( Name(2,filename) );
-    std::ifstream f;
-    f.open(filename);
-    if (!f.is_open()) fatal("Could not open file");
+    MappedFile file (filename);
+
+    const size_t min_chunk_size = 1 << 20;
+    size_t n_chunks = std::max(size_t(1),std::min(get_n_threads(),file.size/min_chunk_size));
+    std::vector <const char*> chunk_begin (n_chunks + 1);
+    chunk_begin[0] = file.begin();
+    chunk_begin[n_chunks] = file.end();
+    for (size_t i = 1; i < n_chunks; ++i)
+      chunk_begin[i] = stl_next_facet(std::max(chunk_begin[i-1],file.begin() + i*file.size/n_chunks),file.end());
+
+    std::vector <StlAsciiChunk> chunks (n_chunks);
+    parallel_for(n_chunks,[&](size_t i) {
+      chunks[i].in_solid = (i > 0);
+      stl_parse_ascii(chunk_begin[i],chunk_begin[i+1],chunks[i]);
+    },1);
+
+    // Empty chunks are skipped, since their in_solid is only the preset
+    std::vector <size_t> chunk_offsets (n_chunks + 1,0);
     bool in_solid = false;
-    std::string token;
-    std::string solid_name;
-    while (f >> token) {
-      if (token == "solid") {
-        std::streamoff curr = f.tellg();
-        f >> solid_name;
-        if (solid_name == "facet") {
-          solid_name.clear();
-          f.seekg(curr);
-        }
-        in_solid = true;
-        continue;
-      } else if (token == "endsolid") {
-        std::streamoff curr = f.tellg();
-        std::string temp;
-        f >> temp;
-        if (temp != solid_name) {
-          f.seekg(curr);
-        }
-        in_solid = false;
-        continue;
-      } else if (in_solid && token == "facet") {
-        f >> token;
-        if (token != "normal") fatal("Expected normal after facet");
-        Vector normal;
-        f >> normal.x;
-        f >> normal.y;
-        f >> normal.z;
-
-        f >> token;
-        if (token != "outer") fatal("Expected outer after normal definition");
-        f >> token;
-        if (token != "loop") fatal("Expected loop after outer");
-
-        size_t i = grid.points.size();
-        grid.points.push_back(stl_read_vertex_ascii(f));
-        grid.points.push_back(stl_read_vertex_ascii(f));
-        grid.points.push_back(stl_read_vertex_ascii(f));
-
-        Element e (Shape::Triangle);
-        e.points[0] = i;
-        e.points[1] = i+1;
-        e.points[2] = i+2;
-        e.name_i = 1;
-        grid.elements.push_back(e);
-
-        f >> token;
-        if (token != "endloop") fatal("Expected endloop");
-        f >> token;
-        if (token != "endfacet") fatal("Expected endfacet");
-      } else {
-        char c_msg[100];
-        snprintf(c_msg,100,"Unknown Token '%s'",token.c_str());
-        fatal(std::string(c_msg));
+    for (size_t i = 0; i < n_chunks; ++i) {
+      if (!chunks[i].error.empty())
+        fatal(chunks[i].error);
+      if (chunk_begin[i] != chunk_begin[i+1]) {
+        if (i > 0 && !in_solid)
+          fatal("Unknown Token 'facet'");
+        in_solid = chunks[i].in_solid;
       }
+      chunk_offsets[i+1] = chunk_offsets[i] + chunks[i].points.size();
     }
-    fprintf(stderr,"%lu Triangles Read\n",grid.elements.size());
-    return grid;
-  }
 
-  uint16_t read_uint16(std::ifstream& f) {
-    uint16_t v;
-    f.read(reinterpret_cast<char *>(&v), sizeof(v));
-    return v;
-  }
+    Grid grid (3);
+    grid.names.push_back( Name(2,filename) );
+    size_t n_points = chunk_offsets.back();
+    size_t n_triangles = n_points/3;
+    check_index_range(n_points);
+    if (n_chunks == 1) {
+      grid.points.swap(chunks[0].points);
+    } else {
+      grid.points.resize(n_points);
+      parallel_for(n_chunks,[&](size_t i) {
+        std::copy(chunks[i].points.begin(),chunks[i].points.end(),grid.points.begin() + chunk_offsets[i]);
+        std::vector <Point>().swap(chunks[i].points);
+      },1);
+    }
 
-  uint32_t read_uint32(std::ifstream& f) {
-    uint32_t v;
-    f.read(reinterpret_cast<char *>(&v), sizeof(v));
-    return v;
-  }
+    ElementList& elements = grid.elements;
+    elements.types.assign(n_triangles,Shape::Triangle);
+    elements.name_indices.assign(n_triangles,1);
+    elements.offsets.resize(n_triangles + 1);
+    elements.connectivity.resize(n_points);
+    parallel_for(elements.offsets.size(),[&](size_t i) { elements.offsets[i] = 3*i; });
+    parallel_for(n_points,[&](size_t i) { elements.connectivity[i] = i; });
 
-  float read_float(std::ifstream& f) {
-    float v;
-    f.read(reinterpret_cast<char *>(&v), sizeof(v));
-    return v;
+    fprintf(stderr,"%lu Triangles Read\n",n_triangles);
+    return grid;
   }
 
-  Point stl_read_vertex_binary(std::ifstream& f) {
-    float x = read_float(f);
-    float y = read_float(f);
-    float z = read_float(f);
-    return Point {x,y,z};
+  namespace {
+    const size_t stl_header_size = 84;
+    const size_t stl_facet_size = 50;
+
+    // Vertex j of facet i. Records are 50 bytes, so the floats are unaligned
+    void stl_binary_vertex(const char* data, size_t i, size_t j, float v[3]) {
+      memcpy(v,data + stl_header_size + i*stl_facet_size + 12*(j+1),3*sizeof(float));
+    }
+
+    uint64_t stl_vertex_hash(const float v[3]) {
+      uint64_t h = 0xcbf29ce484222325ULL;
+      for (size_t k = 0; k < 3; ++k) {
+        float f = v[k] + 0.0f; // -0 and 0 are the same point
+        uint32_t bits;
+        memcpy(&bits,&f,sizeof(bits));
+        h = (h ^ bits) * 0x100000001b3ULL;
+      }
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      return h;
+    }
   }
 
+  // Corners with identical vertices are merged while reading, into the point
+  // of the first corner with that vertex. Each vertex is inserted into a
+  // lock-free open addressing table that keeps the lowest corner that has
+  // it, so points come out in the same order as reading every corner and
+  // calling merge_points(0)
   Grid stl_read_binary(const std::string& filename) {
     fprintf(stderr,"Reading Binary STL File '%s'\n",filename.c_str());
+    MappedFile file (filename);
+    if (file.size < stl_header_size)
+      fatal("(read_stl_binary) File too short for header");
+    uint32_t n_triangles;
+    memcpy(&n_triangles,file.data + 80,sizeof(n_triangles));
+    fprintf(stderr,"Reading %d Triangles\n",n_triangles);
+    size_t n_corners = 3*size_t(n_triangles);
+    check_index_range(n_corners);
+    size_t expected_size = stl_header_size + stl_facet_size*size_t(n_triangles);
+    if (file.size < expected_size)
+      fatal("(read_stl_binary) File too short for number of triangles");
+    if (file.size > expected_size)
+      fatal("(read_stl_binary) End Of File not reached");
+
+    const char* data = file.data;
+    auto same_vertex = [&](size_t c1, size_t c2) {
+      float v1[3], v2[3];
+      stl_binary_vertex(data,c1/3,c1%3,v1);
+      stl_binary_vertex(data,c2/3,c2%3,v2);
+      return v1[0] == v2[0] && v1[1] == v2[1] && v1[2] == v2[2];
+    };
+
     Grid grid (3);
     grid.names.push_back( Name(2,filename) );
-    std::ifstream f;
-    f.open(filename);
-    if (!f.is_open()) fatal("Could not open file");
-    char header[80];
+    std::vector <Index>& connectivity = grid.elements.connectivity;
+    connectivity.resize(n_corners);
 
-    f.read(header, sizeof(header));
-    uint32_t n_triangles = read_uint32(f);
-    fprintf(stderr,"Reading %d Triangles\n",n_triangles);
-
-    for (size_t i = 0; i < n_triangles; ++i) {
-      Point normal = stl_read_vertex_binary(f);
-      grid.points.push_back(stl_read_vertex_binary(f));
-      grid.points.push_back(stl_read_vertex_binary(f));
-      grid.points.push_back(stl_read_vertex_binary(f));
-      uint16_t attr = read_uint16(f);
-
-      Element e (Shape::Triangle);
-      e.points[0] = 3*i;
-      e.points[1] = 3*i+1;
-      e.points[2] = 3*i+2;
-      e.name_i = 1;
-      grid.elements.push_back(e);
+    // A closed surface has about half as many vertices as triangles. If the
+    // table fills up past three quarters it is grown and filled again
+    size_t table_size = 1;
+    while (table_size < 2*size_t(n_triangles))
+      table_size *= 2;
+    std::vector< std::atomic<Index> > table;
+    while (true) {
+      table = std::vector< std::atomic<Index> > (table_size);
+      parallel_for(table_size,[&](size_t i) { table[i].store(max_index,std::memory_order_relaxed); });
+      std::atomic<size_t> n_filled (0);
+      std::atomic<bool> full (false);
+      size_t max_filled = table_size/4*3;
+      parallel_for(n_corners,[&](size_t c) {
+        if (full.load(std::memory_order_relaxed)) return;
+        float v[3];
+        stl_binary_vertex(data,c/3,c%3,v);
+        size_t slot = stl_vertex_hash(v) & (table_size - 1);
+        while (true) {
+          Index j = table[slot].load();
+          if (j == max_index) {
+            if (table[slot].compare_exchange_strong(j,c)) {
+              if (n_filled.fetch_add(1,std::memory_order_relaxed) >= max_filled)
+                full.store(true,std::memory_order_relaxed);
+              break;
+            }
+          }
+          if (same_vertex(j,c)) {
+            while (c < j && !table[slot].compare_exchange_weak(j,c)) {}
+            break;
+          }
+          slot = (slot + 1) & (table_size - 1);
+        }
+        connectivity[c] = slot;
+      },4096);
+      if (!full.load()) break;
+      table_size *= 2;
     }
-    f.get();
-    if (!f.eof())
-      fatal("(read_stl_binary) End Of File not reached");
+
+    // A corner is the first with its vertex if it is still in its slot. Its
+    // point replaces it in the table. Point numbers never exceed the corner
+    // they come from, so a later corner can't mistake one for itself
+    size_t n_chunks = std::max(size_t(1),parallel_chunk_count(n_corners,4096));
+    std::vector <size_t> chunk_points (n_chunks + 1,0);
+    parallel_chunks_n(n_corners,n_chunks,[&](size_t chunk, size_t begin, size_t end) {
+      size_t n = 0;
+      for (size_t c = begin; c < end; ++c) {
+        if (table[connectivity[c]].load(std::memory_order_relaxed) == c)
+          n++;
+      }
+      chunk_points[chunk+1] = n;
+    });
+    for (size_t i = 1; i < chunk_points.size(); ++i)
+      chunk_points[i] += chunk_points[i-1];
+    grid.points.resize(chunk_points.back());
+    parallel_chunks_n(n_corners,n_chunks,[&](size_t chunk, size_t begin, size_t end) {
+      size_t p = chunk_points[chunk];
+      for (size_t c = begin; c < end; ++c) {
+        std::atomic<Index>& slot = table[connectivity[c]];
+        if (slot.load(std::memory_order_relaxed) == c) {
+          float v[3];
+          stl_binary_vertex(data,c/3,c%3,v);
+          grid.points[p] = Point {v[0],v[1],v[2]};
+          slot.store(p,std::memory_order_relaxed);
+          p++;
+        }
+      }
+    });
+    parallel_for(n_corners,[&](size_t c) {
+      connectivity[c] = table[connectivity[c]].load(std::memory_order_relaxed);
+    },4096);
+
+    grid.elements.types.assign(n_triangles,Shape::Triangle);
+    grid.elements.name_indices.assign(n_triangles,1);
+    grid.elements.offsets.resize(size_t(n_triangles) + 1);
+    parallel_for(grid.elements.offsets.size(),[&](size_t i) { grid.elements.offsets[i] = 3*i; });
+
+    fprintf(stderr,"%lu Points After Merging Identical Vertices\n",grid.points.size());
     return grid;
   }
 
@@ -171,7 +339,7 @@ namespace unstruc {
     std::ofstream f (filename, std::ofstream::out);
     std::cerr << "Writing " << filename << std::endl;
     if (!f.is_open()) fatal("Could not open file");
-    for (const Element& e : grid.elements) {
+    for (ConstElementRef e : grid.elements) {
       if (e.type != Shape::Triangle)
         fatal("STL files only support triangles");
       if (e.points.size() != 3)
@@ -179,7 +347,7 @@ namespace unstruc {
     }
     f.precision(DBL_DIG);
     f << "solid" << std::endl;
-    for (const Element& e : grid.elements) {
+    for (ConstElementRef e : grid.elements) {
       f << "  facet normal 0.0 0.0 0.0" << std::endl;
       f << "    outer loop" << std::endl;
       for (size_t _p : e.points) {
@@ -220,7 +388,7 @@ namespace unstruc {
     std::ofstream f (filename, std::ofstream::out | std::ofstream::binary);
     std::cerr << "Writing " << filename << std::endl;
     if (!f.is_open()) fatal("Could not open file");
-    for (const Element& e : grid.elements) {
+    for (ConstElementRef e : grid.elements) {
       if (e.type != Shape::Triangle)
         fatal("STL files only support triangles");
       if (e.points.size() != 3)
@@ -229,7 +397,7 @@ namespace unstruc {
     std::string header (80,' ');
     f << header;
     write_uint32(f,grid.elements.size());
-    for (const Element& e : grid.elements) {
+    for (ConstElementRef e : grid.elements) {
       Vector normal {0, 0, 1};
       stl_write_binary_vertex(f,normal);
       for (size_t _p : e.points) {
@@ -5,14 +5,20 @@
 #include "point.h"
 #include "error.h"
 
+#include "mappedfile.h"
+#include "parallel.h"
+#include "lexer.h"
+#include "volumes.h"
+
 #include <cassert>
 #include <iostream>
-#include <fstream>
-#include <sstream>
-#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
 #include <string>
 #include <vector>
-#include <map>
+#include <atomic>
+#include <algorithm>
 
 namespace unstruc {
 
@@ -26,12 +32,12 @@ namespace unstruc {
     std::cerr << "Writing Elements" << std::endl;
     fprintf(f,"NDIME= %d\n\n",grid.dim);
     size_t n_volume_elements = 0;
-    for (const Element& e : grid.elements)
+    for (ConstElementRef e : grid.elements)
       if (Shape::Info[e.type].dim == grid.dim)
         n_volume_elements++;
 
     fprintf(f,"NELEM= %d\n",n_volume_elements);
-    for (const Element& e : grid.elements) {
+    for (ConstElementRef e : grid.elements) {
       if (Shape::Info[e.type].dim != grid.dim) continue;
       fprintf(f,"%d",Shape::Info[e.type].vtk_id);
       for (size_t p : e.points) {
@@ -53,7 +59,7 @@ namespace unstruc {
     fprintf(f,"\n");
     std::vector<size_t> name_count(grid.names.size(),0);
     for (i = 0; i < grid.elements.size(); i++) {
-      const Element &e = grid.elements[i];
+      ConstElementRef e = grid.elements[i];
       if (Shape::Info[e.type].dim != (grid.dim-1)) continue;
       if (e.name_i == -1) continue;
       name_count[e.name_i]++;
@@ -73,9 +79,9 @@ namespace unstruc {
       fprintf(f,"MARKER_TAG= %s\n",name.name.c_str());
       fprintf(f,"MARKER_ELEMS= %d\n",name_count[i]);
       for (j = 0; j < grid.elements.size(); j++) {
-        const Element &e = grid.elements[j];
+        ConstElementRef e = grid.elements[j];
         if (Shape::Info[e.type].dim != grid.dim - 1) continue;
-        if (e.name_i == -1) continue;
+        if (e.name_i != int(i)) continue;
         fprintf(f,"%d",Shape::Info[e.type].vtk_id);
         for (size_t p : e.points) {
           assert (p < grid.points.size());
@@ -89,178 +95,369 @@ namespace unstruc {
     return true;
   }
 
+  namespace {
+    // Finds the start of any line of a file without reading it line by line.
+    // The newlines in each block of the file are counted in parallel once
+    struct Su2Lines {
+      const char* begin;
+      const char* end;
+      size_t block_size;
+      std::vector <size_t> newlines_before; // Newlines before each block
+
+      Su2Lines(const char* begin, const char* end) : begin(begin), end(end), block_size(1 << 20) {
+        size_t n_blocks = (end - begin + block_size - 1)/block_size;
+        std::vector <size_t> counts (n_blocks);
+        parallel_for(n_blocks,[&](size_t b) {
+          const char* p = begin + b*block_size;
+          counts[b] = std::count(p,std::min(p + block_size,end),'\n');
+        },1);
+        newlines_before.resize(n_blocks + 1);
+        newlines_before[0] = 0;
+        for (size_t b = 0; b < n_blocks; ++b)
+          newlines_before[b+1] = newlines_before[b] + counts[b];
+      };
+
+      size_t size() const {
+        return newlines_before.back() + (begin != end && end[-1] != '\n');
+      };
+
+      // Start of line l, or the end of the file past the last line
+      const char* line(size_t l) const {
+        if (l == 0) return begin;
+        if (l > newlines_before.back()) return end;
+        size_t b = std::lower_bound(newlines_before.begin(),newlines_before.end(),l) - newlines_before.begin() - 1;
+        const char* p = begin + b*block_size;
+        for (size_t k = newlines_before[b]; k < l; ++k)
+          p = static_cast<const char*>(memchr(p,'\n',end - p)) + 1;
+        return p;
+      };
+    };
+
+    inline const char* line_end(const char* p, const char* end) {
+      const char* newline = static_cast<const char*>(memchr(p,'\n',end - p));
+      return newline ? newline : end;
+    }
+
+    // Splits the n lines of a section into contiguous ranges for the threads
+    std::vector <size_t> su2_ranges(size_t n) {
+      const size_t min_range = 4096;
+      size_t n_ranges = std::max(size_t(1),std::min(get_n_threads(),n/min_range));
+      std::vector <size_t> ranges (n_ranges + 1);
+      for (size_t r = 0; r <= n_ranges; ++r)
+        ranges[r] = r*n/n_ranges;
+      return ranges;
+    }
+
+    // First line with an error in each range, reported in file order
+    struct Su2Errors {
+      std::vector <size_t> lines;
+      std::vector <const char*> messages;
+
+      Su2Errors(size_t n_ranges) : lines(n_ranges,SIZE_MAX), messages(n_ranges,nullptr) {};
+
+      void set(size_t r, size_t line, const char* message) {
+        if (lines[r] == SIZE_MAX) {
+          lines[r] = line;
+          messages[r] = message;
+        }
+      };
+
+      void check() const {
+        for (size_t r = 0; r < lines.size(); ++r) {
+          if (lines[r] == SIZE_MAX) continue;
+          char c_msg[200];
+          snprintf(c_msg,200,"%s on line %zu",messages[r],lines[r] + 1);
+          fatal(c_msg);
+        }
+      };
+    };
+
+    // Shapes by VTK id. SU2 only uses shapes with a fixed number of points
+    std::vector <Shape::Type> su2_shape_types() {
+      std::vector <Shape::Type> types;
+      for (size_t i = 0; i < Shape::NShapes; ++i) {
+        if (Shape::Info[i].n_points == 0) continue;
+        if (types.size() <= Shape::Info[i].vtk_id)
+          types.resize(Shape::Info[i].vtk_id + 1,Shape::Undefined);
+        types[Shape::Info[i].vtk_id] = static_cast<Shape::Type>(i);
+      }
+      return types;
+    }
+
+    inline Shape::Type su2_shape_type(const std::vector <Shape::Type>& shape_types, int64_t vtk_id) {
+      if (vtk_id < 0 || size_t(vtk_id) >= shape_types.size()) return Shape::Undefined;
+      return shape_types[vtk_id];
+    }
+
+    // Appends the elements on the n lines from line first_line. The shapes
+    // are read first, which gives the offsets of each range, and then every
+    // range fills in its own part of the connectivity. Point indices are
+    // checked once all the points are known
+    void su2_read_elements(const Su2Lines& lines, size_t first_line, size_t n, int name_i, ElementList& elements) {
+      std::vector <Shape::Type> shape_types = su2_shape_types();
+      std::vector <size_t> ranges = su2_ranges(n);
+      size_t n_ranges = ranges.size() - 1;
+      size_t first_element = elements.size();
+      check_index_range(first_element + n);
+      elements.types.resize(first_element + n);
+      elements.name_indices.resize(first_element + n,name_i);
+      elements.offsets.resize(first_element + n + 1);
+
+      Su2Errors errors (n_ranges);
+      std::vector <size_t> range_offsets (n_ranges + 1,0);
+      parallel_for(n_ranges,[&](size_t r) {
+        const char* p = lines.line(first_line + ranges[r]);
+        for (size_t i = ranges[r]; i < ranges[r+1]; ++i) {
+          const char* end = line_end(p,lines.end);
+          Lexer lex (p,end);
+          int64_t vtk_id;
+          Shape::Type type = Shape::Undefined;
+          if (lex.next_integer(vtk_id))
+            type = su2_shape_type(shape_types,vtk_id);
+          if (type == Shape::Undefined)
+            errors.set(r,first_line + i,"Unrecognized shape type");
+          elements.types[first_element + i] = type;
+          range_offsets[r+1] += Shape::Info[type].n_points;
+          p = std::min(end + 1,lines.end);
+        }
+      },1);
+      errors.check();
+
+      range_offsets[0] = elements.offsets[first_element];
+      for (size_t r = 0; r < n_ranges; ++r)
+        range_offsets[r+1] += range_offsets[r];
+      elements.connectivity.resize(range_offsets.back());
+
+      parallel_for(n_ranges,[&](size_t r) {
+        const char* p = lines.line(first_line + ranges[r]);
+        size_t offset = range_offsets[r];
+        for (size_t i = ranges[r]; i < ranges[r+1]; ++i) {
+          const char* end = line_end(p,lines.end);
+          Lexer lex (p,end);
+          lex.next();
+          size_t n_points = Shape::Info[elements.types[first_element + i]].n_points;
+          for (size_t j = 0; j < n_points; ++j) {
+            int64_t ipoint;
+            if (!lex.next_integer(ipoint) || ipoint < 0 || uint64_t(ipoint) >= max_index) {
+              errors.set(r,first_line + i,"Invalid point index");
+              ipoint = 0;
+            }
+            elements.connectivity[offset + j] = ipoint;
+          }
+          offset += n_points;
+          elements.offsets[first_element + i + 1] = offset;
+          p = std::min(end + 1,lines.end);
+        }
+      },1);
+      errors.check();
+    }
+
+    // Reads the points on the n lines from line first_line. A point may be
+    // followed by its index, which is returned in ids when any of them
+    // differs from the position of the point in the file. The indices are
+    // then read in a second pass that skips over the coordinates
+    void su2_read_points(const Su2Lines& lines, size_t first_line, size_t n, int dim, std::vector <Point>& points, std::vector <Index>& ids) {
+      std::vector <size_t> ranges = su2_ranges(n);
+      size_t n_ranges = ranges.size() - 1;
+      points.resize(n);
+      ids.clear();
+
+      Su2Errors errors (n_ranges);
+      std::vector <char> in_order (n_ranges,true);
+      auto read = [&](bool read_ids) {
+        parallel_for(n_ranges,[&](size_t r) {
+          const char* p = lines.line(first_line + ranges[r]);
+          for (size_t i = ranges[r]; i < ranges[r+1]; ++i) {
+            const char* end = line_end(p,lines.end);
+            Lexer lex (p,end);
+            if (read_ids) {
+              for (int j = 0; j < dim; ++j)
+                lex.next();
+            } else {
+              Point& point = points[i];
+              point.z = 0;
+              if (!lex.next_double(point.x) || !lex.next_double(point.y) || (dim == 3 && !lex.next_double(point.z)))
+                errors.set(r,first_line + i,"Expected number in point");
+            }
+            Token token = lex.next();
+            int64_t id = i;
+            if (!token.empty() && (!parse_integer(token.begin,token.end,id) || id < 0 || uint64_t(id) >= max_index))
+              errors.set(r,first_line + i,"Invalid point index");
+            if (uint64_t(id) != i)
+              in_order[r] = false;
+            if (read_ids)
+              ids[i] = id;
+            p = std::min(end + 1,lines.end);
+          }
+        },1);
+        errors.check();
+      };
+      read(false);
+      if (std::find(in_order.begin(),in_order.end(),false) != in_order.end()) {
+        ids.resize(n);
+        read(true);
+      }
+    }
+
+    // Value after a keyword such as NELEM=, which may follow the = directly
+    // or after whitespace
+    bool su2_keyword(Lexer& lex, Token token, const char* keyword, Token& value) {
+      size_t n = strlen(keyword);
+      if (token.size() < n || memcmp(token.begin,keyword,n) != 0) return false;
+      if (token.size() > n)
+        value = Token(token.begin + n,token.end);
+      else
+        value = lex.next();
+      return true;
+    }
+
+    size_t su2_count(Token value, const char* keyword) {
+      int64_t n;
+      if (!parse_integer(value.begin,value.end,n) || n < 0)
+        fatal(std::string("Invalid ") + keyword + " '" + value.str() + "'");
+      return n;
+    }
+  }
+
+  // The file is mapped and walked one keyword line at a time. Every section
+  // declares its number of lines, so the lines after a keyword are located
+  // directly and split between the threads
   Grid su2_read(const std::string& inputfile) {
+    fprintf(stderr,"Opening SU2 File '%s'\n",inputfile.c_str());
+    MappedFile file (inputfile);
+    Su2Lines lines (file.begin(),file.end());
+    size_t n_lines = lines.size();
+
     Grid grid;
-    size_t ipoint, iname, i, j, k;
-    size_t nelem;
-    Name name;
-    std::ifstream f;
-    std::istringstream ls;
-    std::string line, token;
-    std::map<size_t,size_t> point_map;
-    bool use_point_map = false;
-    f.open(inputfile.c_str(),std::ios::in);
-    std::cerr << "Opening SU2 File '" << inputfile << "'" << std::endl;
-    if (!f.is_open()) fatal("Could not open file");
+    std::vector <Index> ids;
     bool read_dime = false, read_poin = false, read_elem = false;
-    while (getline(f,line)) {
-      std::stringstream ss(line);
-      ss >> token;
-      if (!ss) continue;
-      if (token.substr(0,6) == "NDIME=") {
+    size_t l = 0;
+    const char* p = file.begin();
+    bool skipped = false;
+    // First of the n lines after the current one, which are skipped over
+    auto section = [&](size_t n) {
+      if (l + n >= n_lines) fatal("Unexpected end of file");
+      skipped = true;
+      return l + 1;
+    };
+    while (l < n_lines) {
+      const char* end = line_end(p,file.end());
+      Lexer lex (p,end);
+      Token token = lex.next();
+      Token value;
+      if (su2_keyword(lex,token,"NDIME=",value)) {
         read_dime = true;
-        if (token.size() > 6)
-          grid.dim = std::atoi(token.substr(6).c_str());
-        else
-          ss >> grid.dim;
-        std::cerr << grid.dim << " Dimensions" << std::endl;
+        grid.dim = su2_count(value,"NDIME=");
+        if (grid.dim != 2 && grid.dim != 3) fatal("Invalid NDIME=");
+        fprintf(stderr,"%zu Dimensions\n",grid.dim);
 
         //Create default named block to be assigned to all elements
-        name = Name();
+        Name name;
         name.name.assign("default");
         name.dim = grid.dim;
         grid.names.push_back(name);
-      } else if (token.substr(0,6) == "NELEM=") {
+      } else if (su2_keyword(lex,token,"NELEM=",value)) {
         read_elem = true;
-        size_t n_elems = 0;
-        if (token.size() > 6)
-          n_elems = std::atoi(token.substr(6).c_str());
-        else
-          ss >> n_elems;
-        std::cerr << n_elems << " Elements" << std::endl;
-        grid.elements.reserve(n_elems);
-        for (size_t i = 0; i < n_elems; ++i) {
-          getline(f,line);
-          std::stringstream ss(line);
-          size_t vtk_id;
-          ss >> vtk_id;
-          Shape::Type type = type_from_vtk_id(vtk_id);
-          if (type == Shape::Undefined) fatal("Unrecognized shape type");
-          Element elem = Element(type);
-          //Assign to default name block
-          elem.name_i = 0;
-          for (j = 0; j < elem.points.size(); ++j) {
-            ss >> ipoint;
-            elem.points[j] = ipoint;
-          }
-          grid.elements.push_back(elem);
-        }
-      } else if (token.substr(0,6) == "NPOIN=") {
+        size_t n_elems = su2_count(value,"NELEM=");
+        fprintf(stderr,"%zu Elements\n",n_elems);
+        su2_read_elements(lines,section(n_elems),n_elems,0,grid.elements);
+        l += n_elems;
+      } else if (su2_keyword(lex,token,"NPOIN=",value)) {
         read_poin = true;
-        size_t n_points = 0;
-        if (token.size() > 6)
-          n_points = std::atoi(token.substr(6).c_str());
-        else
-          ss >> n_points;
-
-        grid.points.resize(n_points);
-        ss >> n_points;
-
-        if (n_points > grid.points.size())
-          grid.points.resize(n_points);
-
-        std::cerr << n_points << " Points" << std::endl;
-
-        for (i = 0; i < n_points; ++i) {
-          getline(f,line);
-          std::stringstream ss(line);
-          Point point;
-          ss >> point.x;
-          ss >> point.y;
-          if (!grid.dim)
-            fatal("Dimension (NDIME) not defined");
-          if (grid.dim == 3)
-            ss >> point.z;
-
-          if (!ss.eof()) {
-            ss >> ipoint;
-            use_point_map = true;
-          } else {
-            ipoint = i;
-          }
-          point_map[ipoint] = i;
-          grid.points[i] = point;
-        }
-      } else if (token.substr(0,6) == "NMARK=") {
-        size_t nmark;
-        if (token.size() > 6)
-          nmark = std::atoi(token.substr(6).c_str());
-        else
-          ss >> nmark;
-
-        std::cerr << nmark << " Markers" << std::endl;
-        for (i = 0; i < nmark; i++) {
-          name = Name();
-          name.dim = grid.dim-1;
-          iname = grid.names.size();
-
-          // Read MARKER_TAG=
-          getline(f,line);
-          std::stringstream ss(line);
-          ss >> token;
-          if (token.substr(0,11) != "MARKER_TAG=")
+        if (!grid.dim) fatal("Dimension (NDIME) not defined");
+        size_t n_points = su2_count(value,"NPOIN=");
+        fprintf(stderr,"%zu Points\n",n_points);
+        check_index_range(n_points);
+        su2_read_points(lines,section(n_points),n_points,grid.dim,grid.points,ids);
+        l += n_points;
+      } else if (su2_keyword(lex,token,"NMARK=",value)) {
+        size_t n_markers = su2_count(value,"NMARK=");
+        fprintf(stderr,"%zu Markers\n",n_markers);
+        for (size_t i = 0; i < n_markers; ++i) {
+          Name name;
+          name.dim = grid.dim - 1;
+
+          p = lines.line(++l);
+          lex = Lexer(p,line_end(p,file.end()));
+          if (!su2_keyword(lex,lex.next(),"MARKER_TAG=",value))
             fatal("Invalid Marker Definition: Expected MARKER_TAG=");
-          if (token.size() > 11) {
-            name.name.assign(token.substr(11));
-          } else {
-            ss >> token;
-            name.name.assign(token);
-          }
+          name.name = value.str();
           grid.names.push_back(name);
-          std::cerr << name.name << std::endl;
-
-          // Read MARKER_ELEMS=
-          getline(f,line);
-          ss.clear();
-          ss.str(line);
-          ss >> token;
-          if (token.substr(0,13) != "MARKER_ELEMS=")
+          fprintf(stderr,"%s\n",name.name.c_str());
+
+          p = lines.line(++l);
+          lex = Lexer(p,line_end(p,file.end()));
+          if (!su2_keyword(lex,lex.next(),"MARKER_ELEMS=",value))
             fatal("Invalid Marker Definition: Expected MARKER_ELEMS=");
-          if (token.size() > 13)
-            nelem = std::atoi(token.substr(13).c_str());
-          else
-            ss >> nelem;
-          for (j = 0; j < nelem; j++) {
-            getline(f,line);
-            ss.clear();
-            ss.str(line);
-            size_t vtk_id;
-            ss >> vtk_id;
-            Shape::Type type = type_from_vtk_id(vtk_id);
-            if (type == Shape::Undefined) fatal("Unrecognized shape type");
-            Element elem = Element(type);
-            for (k=0; k<elem.points.size(); k++) {
-              ss >> ipoint;
-              if (ipoint >= grid.points.size()) fatal("Error Marker Element");
-              elem.points[k] = ipoint;
-            }
-            elem.name_i = iname;
-            grid.elements.push_back(elem);
-          }
+          size_t n_elems = su2_count(value,"MARKER_ELEMS=");
+          su2_read_elements(lines,section(n_elems),n_elems,grid.names.size() - 1,grid.elements);
+          l += n_elems;
         }
+        skipped = true;
       }
+      p = skipped ? lines.line(l + 1) : std::min(end + 1,file.end());
+      skipped = false;
+      ++l;
     }
-    assert (read_dime);
-    assert (read_elem);
-    assert (read_poin);
-    size_t n_negative = 0;
-    for (Element& e : grid.elements) {
-      if (use_point_map) {
-        for (size_t& p : e.points) {
-          assert (point_map.count(p) == 1);
-          p = point_map[p];
+    if (!read_dime) fatal("Dimension (NDIME) not defined");
+    if (!read_elem) fatal("Elements (NELEM) not defined");
+    if (!read_poin) fatal("Points (NPOIN) not defined");
+
+    // Point indices given in the file are replaced by positions
+    std::vector <Index>& connectivity = grid.elements.connectivity;
+    std::atomic<bool> invalid (false);
+    if (ids.empty()) {
+      parallel_for(connectivity.size(),[&](size_t i) {
+        if (connectivity[i] >= grid.points.size())
+          invalid = true;
+      });
+    } else {
+      // Usually the indices are a permutation, so the position of each index
+      // can be looked up in a table. Sparse indices are sorted instead
+      Index max_id = *std::max_element(ids.begin(),ids.end());
+      if (max_id < 2*ids.size()) {
+        std::vector <Index> positions (size_t(max_id) + 1,max_index);
+        for (size_t i = 0; i < ids.size(); ++i) {
+          if (positions[ids[i]] != max_index)
+            fatal("Duplicate point index");
+          positions[ids[i]] = i;
         }
-      }
-      if (e.calc_volume(grid) < 0) {
-        if (e.type == Shape::Tetra) {
-          std::swap(e.points[1],e.points[2]);
-          assert (e.calc_volume(grid) > 0);
+        parallel_for(connectivity.size(),[&](size_t i) {
+          Index p = connectivity[i] <= max_id ? positions[connectivity[i]] : max_index;
+          if (p == max_index)
+            invalid = true;
+          else
+            connectivity[i] = p;
+        });
+      } else {
+        std::vector< std::pair<Index,Index> > id_points (ids.size());
+        parallel_for(ids.size(),[&](size_t i) { id_points[i] = std::make_pair(ids[i],Index(i)); });
+        parallel_sort(id_points.begin(),id_points.end(),std::less< std::pair<Index,Index> >());
+        for (size_t i = 1; i < id_points.size(); ++i) {
+          if (id_points[i].first == id_points[i-1].first)
+            fatal("Duplicate point index");
         }
-        n_negative++;
+        parallel_for(connectivity.size(),[&](size_t i) {
+          auto it = std::lower_bound(id_points.begin(),id_points.end(),std::make_pair(connectivity[i],Index(0)));
+          if (it == id_points.end() || it->first != connectivity[i])
+            invalid = true;
+          else
+            connectivity[i] = it->second;
+        });
+      }
+    }
+    if (invalid) fatal("Element uses an undefined point");
+
+    std::vector <Index> negative = find_negative_volumes(grid);
+    for (Index i : negative) {
+      ElementRef e = grid.elements[i];
+      if (e.type == Shape::Tetra) {
+        std::swap(e.points[1],e.points[2]);
+        assert (e.calc_volume(grid) > 0);
       }
     }
-    if (n_negative)
-      fprintf(stderr,"%d Negative Volume Elements\n",n_negative);
+    if (!negative.empty())
+      fprintf(stderr,"%zu Negative Volume Elements\n",negative.size());
     return grid;
   }
 
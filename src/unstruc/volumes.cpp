@@ -0,0 +1,238 @@
+#include "volumes.h"
+
+#include "grid.h"
+#include "error.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+
+namespace unstruc {
+
+  double tetra_volume(const Point* points, const Index* e) {
+    const Point& p0 = points[e[0]];
+    const Point& p1 = points[e[1]];
+    const Point& p2 = points[e[2]];
+    const Point& p3 = points[e[3]];
+    Vector v1 = p1 - p0;
+    Vector v2 = p2 - p1;
+    Vector v = cross(v1,v2);
+    Vector v3 = p3 - p1;
+    return dot(v,v3)/6;
+  }
+
+  double pyramid_volume(const Point* points, const Index* e) {
+    const Point& p0 = points[e[0]];
+    const Point& p1 = points[e[1]];
+    const Point& p2 = points[e[2]];
+    const Point& p3 = points[e[3]];
+    const Point& p4 = points[e[4]];
+
+    Vector v1 = p2 - p0;
+    Vector v2 = p3 - p1;
+    Vector v = cross(v1,v2);
+    Vector v3 = p4 - p0;
+    Vector v4 = p4 - p1;
+    return dot(v3,v)/12 + dot(v4,v)/12;
+  }
+
+  double wedge_volume(const Point* points, const Index* e) {
+    const Point& p0 = points[e[0]];
+    const Point& p1 = points[e[1]];
+    const Point& p2 = points[e[2]];
+    const Point& p3 = points[e[3]];
+    const Point& p4 = points[e[4]];
+    const Point& p5 = points[e[5]];
+
+    Point c1 = (p0 + p1 + p2)/3;
+    Point c2 = (p3 + p4 + p5)/3;
+
+    Vector l = c1 - c2;
+    Vector v01 = p1 - p0;
+    Vector v12 = p2 - p1;
+    Vector n1 = cross(v01,v12)/2;
+    Vector v34 = p4 - p3;
+    Vector v45 = p5 - p4;
+    Vector n2 = cross(v34,v45)/2;
+    return (dot(l,n1) + dot(l,n2))/2;
+  }
+
+  double hexa_volume(const Point* points, const Index* e) {
+    const Point& p0 = points[e[0]];
+    const Point& p1 = points[e[1]];
+    const Point& p2 = points[e[2]];
+    const Point& p3 = points[e[3]];
+    const Point& p4 = points[e[4]];
+    const Point& p5 = points[e[5]];
+    const Point& p6 = points[e[6]];
+    const Point& p7 = points[e[7]];
+
+    Point face_center1 { 0, 0, 0};
+    double total_length1 = 0;
+    for (size_t i = 0; i < 4; ++i) {
+      size_t j = (i + 1)%4;
+      const Point& pi = points[e[i]];
+      const Point& pj = points[e[j]];
+      double l = (pj - pi).length();
+      total_length1 += l;
+
+      face_center1 += (pi + pj)/2*l;
+    }
+    face_center1 /= total_length1;
+
+    Point face_center2 { 0, 0, 0 };
+    double total_length2 = 0;
+    for (size_t i = 4; i < 8; ++i) {
+      size_t j = 4 + (i + 1)%4;
+      const Point& pi = points[e[i]];
+      const Point& pj = points[e[j]];
+      double l = (pj - pi).length();
+      total_length2 += l;
+
+      face_center2 += (pi + pj)/2*l;
+    }
+    face_center2 /= total_length2;
+
+    Vector l = face_center2 - face_center1;
+    Vector v02 = p2 - p0;
+    Vector v13 = p3 - p1;
+    Vector n1 = cross(v02,v13)/2;
+
+    Vector v46 = p6 - p4;
+    Vector v57 = p7 - p5;
+    Vector n2 = cross(v46,v57)/2;
+
+    return (dot(l,n1) + dot(l,n2))/2;
+  }
+
+  namespace {
+    template <double (*kernel)(const Point*, const Index*)>
+    void volume_batch(const Grid& grid, size_t begin, size_t end, double* volumes) {
+      const Point* points = grid.points.data();
+      const Index* connectivity = grid.elements.connectivity.data();
+      const size_t* offsets = grid.elements.offsets.data();
+      for (size_t i = begin; i < end; ++i)
+        volumes[i] = kernel(points,connectivity + offsets[i]);
+    }
+
+    void calc_volume_range(const Grid& grid, size_t begin, size_t end, double* volumes) {
+      const std::vector <Shape::Type>& types = grid.elements.types;
+      while (begin < end) {
+        Shape::Type type = types[begin];
+        size_t run_end = begin + 1;
+        while (run_end < end && types[run_end] == type)
+          run_end++;
+        switch (type) {
+        case Shape::Tetra:
+          volume_batch<tetra_volume>(grid,begin,run_end,volumes);
+          break;
+        case Shape::Pyramid:
+          volume_batch<pyramid_volume>(grid,begin,run_end,volumes);
+          break;
+        case Shape::Wedge:
+          volume_batch<wedge_volume>(grid,begin,run_end,volumes);
+          break;
+        case Shape::Hexa:
+          volume_batch<hexa_volume>(grid,begin,run_end,volumes);
+          break;
+        case Shape::Line:
+        case Shape::Triangle:
+        case Shape::Quad:
+        case Shape::Polygon:
+          std::fill(volumes + begin,volumes + run_end,0.0);
+          break;
+        default:
+          fatal("Invalid Element Type");
+        }
+        begin = run_end;
+      }
+    }
+  }
+
+  std::vector <double> calc_volumes(const Grid& grid) {
+    std::vector <double> volumes (grid.elements.size());
+    parallel_chunks(grid.elements.size(),[&](size_t, size_t begin, size_t end) {
+      calc_volume_range(grid,begin,end,volumes.data());
+    });
+    return volumes;
+  }
+
+  std::vector <Index> find_negative_volumes(const Grid& grid) {
+    std::vector <double> volumes = calc_volumes(grid);
+    std::vector <Index> negative;
+    for (size_t i = 0; i < volumes.size(); ++i) {
+      if (volumes[i] < 0)
+        negative.push_back(i);
+    }
+    return negative;
+  }
+
+  NegativeVolumeTracker::NegativeVolumeTracker(const Grid& grid) : points(grid.points), n_updated_elements(grid.elements.size()) {
+    const ElementList& elements = grid.elements;
+    size_t n_points = grid.points.size();
+    check_index_range(elements.size());
+
+    std::vector< std::atomic<size_t> > counts (n_points + 1);
+    parallel_for(counts.size(),[&](size_t i) { counts[i].store(0,std::memory_order_relaxed); });
+    parallel_for(elements.connectivity.size(),[&](size_t i) { counts[elements.connectivity[i]].fetch_add(1,std::memory_order_relaxed); });
+    point_offsets.resize(n_points + 1);
+    point_offsets[0] = 0;
+    for (size_t p = 0; p < n_points; ++p)
+      point_offsets[p+1] = point_offsets[p] + counts[p].load(std::memory_order_relaxed);
+    parallel_for(n_points,[&](size_t p) { counts[p].store(point_offsets[p],std::memory_order_relaxed); });
+    point_elements.resize(point_offsets.back());
+    parallel_for(elements.size(),[&](size_t i) {
+      for (size_t j = elements.offsets[i]; j < elements.offsets[i+1]; ++j)
+        point_elements[counts[elements.connectivity[j]].fetch_add(1,std::memory_order_relaxed)] = i;
+    });
+
+    volumes = calc_volumes(grid);
+    for (size_t i = 0; i < volumes.size(); ++i) {
+      if (volumes[i] < 0)
+        negative.push_back(i);
+    }
+  }
+
+  const std::vector <Index>& NegativeVolumeTracker::update(const Grid& grid) {
+    if (grid.points.size() != points.size())
+      fatal("(unstruc::NegativeVolumeTracker) Number of points changed");
+
+    std::vector <unsigned char> moved_points (points.size());
+    parallel_for(points.size(),[&](size_t i) {
+      moved_points[i] = !(grid.points[i] == points[i]);
+      if (moved_points[i])
+        points[i] = grid.points[i];
+    });
+    std::vector <Index> moved;
+    for (size_t i = 0; i < moved_points.size(); ++i) {
+      if (moved_points[i])
+        moved.push_back(i);
+    }
+
+    std::vector <Index> updated;
+    for (Index p : moved)
+      updated.insert(updated.end(),point_elements.begin() + point_offsets[p],point_elements.begin() + point_offsets[p+1]);
+    std::sort(updated.begin(),updated.end());
+    updated.erase(std::unique(updated.begin(),updated.end()),updated.end());
+    n_updated_elements = updated.size();
+
+    parallel_for(updated.size(),[&](size_t j) {
+      Index i = updated[j];
+      calc_volume_range(grid,i,i+1,volumes.data());
+    });
+
+    // Elements that weren't updated keep their state
+    std::vector <Index> still_negative;
+    std::set_difference(negative.begin(),negative.end(),updated.begin(),updated.end(),std::back_inserter(still_negative));
+    std::vector <Index> now_negative;
+    for (Index i : updated) {
+      if (volumes[i] < 0)
+        now_negative.push_back(i);
+    }
+    negative.clear();
+    std::merge(still_negative.begin(),still_negative.end(),now_negative.begin(),now_negative.end(),std::back_inserter(negative));
+    return negative;
+  }
+
+} //namespace unstruc
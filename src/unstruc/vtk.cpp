@@ -4,16 +4,120 @@
 #include "element.h"
 #include "point.h"
 #include "error.h"
+#include "lexer.h"
+#include "mappedfile.h"
+#include "parallel.h"
 
 #include <memory>
 #include <cstring>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
 
 namespace unstruc {
 
-  bool vtk_write(const std::string& filename, const Grid &grid) {
+  namespace {
+    bool host_is_little_endian() {
+      const uint16_t one = 1;
+      unsigned char c;
+      memcpy(&c,&one,1);
+      return c == 1;
+    }
+
+    // Binary legacy VTK is big-endian
+    template <typename T>
+    void store_big_endian(char* out, T v) {
+      memcpy(out,&v,sizeof(T));
+      if (host_is_little_endian())
+        std::reverse(out,out + sizeof(T));
+    }
+
+    template <typename T>
+    T load_big_endian(const char* in) {
+      char bytes[sizeof(T)];
+      memcpy(bytes,in,sizeof(T));
+      if (host_is_little_endian())
+        std::reverse(bytes,bytes + sizeof(T));
+      T v;
+      memcpy(&v,bytes,sizeof(T));
+      return v;
+    }
+
+    // Values are converted into a buffer in parallel and written in one go
+    template <typename T, typename F>
+    void write_big_endian(FILE* f, size_t n, F value) {
+      std::vector <char> buffer (n*sizeof(T));
+      parallel_for(n,[&](size_t i) { store_big_endian<T>(buffer.data() + i*sizeof(T),value(i)); });
+      if (n > 0 && fwrite(buffer.data(),1,buffer.size(),f) != buffer.size())
+        fatal("Could not write file");
+    }
+
+    int32_t vtk_int(size_t v) {
+      if (v > size_t(INT32_MAX))
+        fatal("Value too large for VTK file");
+      return int32_t(v);
+    }
+
+    FILE* vtk_append(const std::string& filename) {
+      FILE* f = fopen(filename.c_str(),"ab");
+      if (!f) fatal("Could not open file");
+      return f;
+    }
+  }
+
+  bool vtk_write(const std::string& filename, const Grid &grid, bool binary) {
+    if (!binary)
+      return vtk_write_ascii(filename,grid);
+    FILE * f;
+    f = fopen(filename.c_str(),"wb");
+    std::cerr << "Writing " << filename << std::endl;
+    if (!f) fatal("Could not open file");
+    const ElementList& elements = grid.elements;
+    size_t n_points = grid.points.size();
+    size_t n_elements = elements.size();
+    size_t n_connectivity = elements.connectivity.size();
+    vtk_int(n_points); // Point indices are written as ints
+    fprintf(f,"# vtk DataFile Version 2.0\n");
+    fprintf(f,"Description\n");
+    fprintf(f,"BINARY\n");
+    fprintf(f,"DATASET UNSTRUCTURED_GRID\n");
+    fprintf(f,"POINTS %lu double\n",n_points);
+    write_big_endian<double>(f,3*n_points,[&](size_t i) {
+      const Point& p = grid.points[i/3];
+      switch (i%3) {
+      case 0: return p.x;
+      case 1: return p.y;
+      default: return grid.dim == 3 ? p.z : 0.0;
+      }
+    });
+
+    // Each cell is its point count followed by its points, so the point at
+    // position j of the connectivity is written at j plus its cell index + 1
+    fprintf(f,"\nCELLS %d %d\n",vtk_int(n_elements),vtk_int(n_elements + n_connectivity));
+    std::vector <int32_t> cells (n_elements + n_connectivity);
+    parallel_for(n_elements,[&](size_t i) {
+      size_t begin = elements.offsets[i];
+      size_t end = elements.offsets[i+1];
+      int32_t* cell = cells.data() + begin + i;
+      cell[0] = end - begin;
+      for (size_t j = begin; j < end; ++j)
+        cell[j - begin + 1] = elements.connectivity[j];
+    });
+    write_big_endian<int32_t>(f,cells.size(),[&](size_t i) { return cells[i]; });
+    std::vector <int32_t>().swap(cells);
+
+    fprintf(f,"\nCELL_TYPES %d\n",vtk_int(n_elements));
+    write_big_endian<int32_t>(f,n_elements,[&](size_t i) { return int32_t(Shape::Info[elements.types[i]].vtk_id); });
+    fprintf(f,"\n");
+    fclose(f);
+    return true;
+  }
+
+  bool vtk_write_ascii(const std::string& filename, const Grid &grid) {
     FILE * f;
     f = fopen(filename.c_str(),"w");
     std::cerr << "Writing " << filename << std::endl;
@@ -34,12 +138,12 @@ namespace unstruc {
     //std::cerr << "Writing Cells" << std::endl;
     size_t n_volume_elements = 0;
     size_t n_elvals = 0;
-    for (const Element& e : grid.elements) {
+    for (ConstElementRef e : grid.elements) {
       n_volume_elements++;
       n_elvals += e.points.size()+1;
     }
     fprintf(f,"CELLS %d %d\n",n_volume_elements,n_elvals);
-    for (const Element& e : grid.elements) {
+    for (ConstElementRef e : grid.elements) {
       fprintf(f,"%d",e.points.size());
       for (size_t p : e.points) {
         fprintf(f," %d",p);
@@ -48,7 +152,7 @@ namespace unstruc {
     }
 
     fprintf(f,"CELL_TYPES %d\n",n_volume_elements);
-    for (const Element& e : grid.elements) {
+    for (ConstElementRef e : grid.elements) {
       fprintf(f,"%d\n",Shape::Info[e.type].vtk_id);
     }
     fclose(f);
@@ -56,49 +160,59 @@ namespace unstruc {
   }
 
   void vtk_write_point_data_header(const std::string& filename, const Grid& grid) {
-    std::ofstream f (filename, std::ios::app);
-    if (!f.is_open()) fatal("Could not open file");
-    f << std::endl << "POINT_DATA " << grid.points.size() << std::endl;
+    FILE* f = vtk_append(filename);
+    fprintf(f,"\nPOINT_DATA %lu\n",grid.points.size());
+    fclose(f);
   }
 
   void vtk_write_cell_data_header(const std::string& filename, const Grid& grid) {
-    std::ofstream f (filename, std::ios::app);
-    if (!f.is_open()) fatal("Could not open file");
-    f << std::endl << "CELL_DATA " << grid.points.size() << std::endl;
+    FILE* f = vtk_append(filename);
+    fprintf(f,"\nCELL_DATA %lu\n",grid.elements.size());
+    fclose(f);
   }
 
-  void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <size_t>& scalars) {
-    std::ofstream f (filename, std::ios::app);
-    if (!f.is_open()) fatal("Could not open file");
-    f << "SCALARS " << name << " int 1" << std::endl;
-    f << "LOOKUP_TABLE" << std::endl;
-    for (size_t s : scalars) {
-      f << s << std::endl;
+  void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <size_t>& scalars, bool binary) {
+    FILE* f = vtk_append(filename);
+    fprintf(f,"SCALARS %s int 1\n",name.c_str());
+    fprintf(f,"LOOKUP_TABLE default\n");
+    if (binary) {
+      write_big_endian<int32_t>(f,scalars.size(),[&](size_t i) { return vtk_int(scalars[i]); });
+    } else {
+      for (size_t s : scalars)
+        fprintf(f,"%lu\n",s);
     }
-    f << std::endl;
+    fprintf(f,"\n");
+    fclose(f);
   }
 
-  void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <double>& scalars) {
-    std::ofstream f (filename, std::ios::app);
-    if (!f.is_open()) fatal("Could not open file");
-    f.precision(15);
-    f << "SCALARS " << name << " double 1" << std::endl;
-    f << "LOOKUP_TABLE default" << std::endl;
-    for (double s : scalars) {
-      f << s << std::endl;
+  void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <double>& scalars, bool binary) {
+    FILE* f = vtk_append(filename);
+    fprintf(f,"SCALARS %s double 1\n",name.c_str());
+    fprintf(f,"LOOKUP_TABLE default\n");
+    if (binary) {
+      write_big_endian<double>(f,scalars.size(),[&](size_t i) { return scalars[i]; });
+    } else {
+      for (double s : scalars)
+        fprintf(f,"%.15g\n",s);
     }
-    f << std::endl;
+    fprintf(f,"\n");
+    fclose(f);
   }
 
-  void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <Vector>& vectors) {
-    std::ofstream f (filename, std::ios::app);
-    if (!f.is_open()) fatal("Could not open file");
-    f.precision(15);
-    f << "Vectors " << name << " double" << std::endl;
-    for (const Vector& v : vectors) {
-      f << v.x << " " << v.y << " " << v.z << std::endl;
+  void vtk_write_data(const std::string& filename, const std::string& name, const std::vector <Vector>& vectors, bool binary) {
+    FILE* f = vtk_append(filename);
+    fprintf(f,"VECTORS %s double\n",name.c_str());
+    if (binary) {
+      write_big_endian<double>(f,3*vectors.size(),[&](size_t i) {
+        const Vector& v = vectors[i/3];
+        return i%3 == 0 ? v.x : (i%3 == 1 ? v.y : v.z);
+      });
+    } else {
+      for (const Vector& v : vectors)
+        fprintf(f,"%.15g %.15g %.15g\n",v.x,v.y,v.z);
     }
-    f << std::endl;
+    fprintf(f,"\n");
+    fclose(f);
   }
 
   std::unique_ptr<Grid> vtk_read_ascii(std::ifstream& f) {
@@ -120,6 +234,7 @@ namespace unstruc {
     f >> token;
     if (token != "double") return nullptr;
 
+    check_index_range(n_points);
     grid->points.reserve(n_points);
     for (size_t i = 0; i < n_points; ++i) {
       Point p;
@@ -150,7 +265,8 @@ namespace unstruc {
     f >> n_cells2;
     if (!f || n_cells != n_cells2) return nullptr;
 
-    grid->elements.reserve(n_cells);
+    check_index_range(n_cells);
+    grid->elements.reserve(n_cells,n_cells_size-n_cells);
 
     size_t cj = 0;
     for (size_t i = 0; i < n_cells; ++i) {
@@ -164,15 +280,11 @@ namespace unstruc {
       if (Shape::Info[type].n_points && Shape::Info[type].n_points != n_elem_points)
         return nullptr;
 
-      Element e (type);
-      if (Shape::Info[type].n_points == 0)
-        e.points.resize(n_elem_points);
-
+      ElementRef e = grid->elements.emplace_back(type,0,n_elem_points);
       for (size_t j = 0; j < n_elem_points; ++j) {
         e.points[j] = cells[cj];
         cj++;
       }
-      grid->elements.push_back(e);
     }
     if (!f) return nullptr;
     if (cj != n_cells_size) return nullptr;
@@ -180,6 +292,108 @@ namespace unstruc {
     return std::move(grid);
   }
 
+  namespace {
+    void skip_line(Lexer& lex) {
+      lex.rest_of_line();
+      if (lex.p != lex.end) lex.p++;
+    }
+
+    // Raw data starts on the line after its keyword line. The count comes
+    // from the file, so it is checked against the bytes left before it is
+    // multiplied
+    const char* binary_data(Lexer& lex, int64_t n_values, size_t value_size) {
+      skip_line(lex);
+      if (n_values < 0 || uint64_t(n_values) > size_t(lex.end - lex.p)/value_size) return nullptr;
+      const char* data = lex.p;
+      lex.p += n_values*value_size;
+      return data;
+    }
+  }
+
+  std::unique_ptr<Grid> vtk_read_binary(const MappedFile& file) {
+    std::unique_ptr<Grid> grid (new Grid (3));
+    Lexer lex (file.begin(),file.end());
+    skip_line(lex);
+    skip_line(lex);
+    if (lex.next() != "BINARY") return nullptr;
+    if (lex.next() != "DATASET") return nullptr;
+    if (lex.next() != "UNSTRUCTURED_GRID") return nullptr;
+    if (lex.next() != "POINTS") return nullptr;
+
+    int64_t n_points;
+    if (!lex.next_integer(n_points) || n_points < 0) return nullptr;
+    Token type = lex.next();
+    size_t value_size;
+    if (type == "double")
+      value_size = sizeof(double);
+    else if (type == "float")
+      value_size = sizeof(float);
+    else
+      return nullptr;
+    check_index_range(n_points);
+    const char* point_data = binary_data(lex,n_points,3*value_size);
+    if (!point_data) return nullptr;
+    grid->points.resize(n_points);
+    parallel_for(n_points,[&](size_t i) {
+      double x[3];
+      for (size_t j = 0; j < 3; ++j) {
+        const char* v = point_data + (3*i + j)*value_size;
+        x[j] = value_size == sizeof(double) ? load_big_endian<double>(v) : load_big_endian<float>(v);
+      }
+      grid->points[i] = Point {x[0],x[1],x[2]};
+    });
+
+    if (lex.next() != "CELLS") return nullptr;
+    int64_t n_cells, n_cells_size;
+    if (!lex.next_integer(n_cells) || !lex.next_integer(n_cells_size)) return nullptr;
+    if (n_cells < 0 || n_cells_size < n_cells) return nullptr;
+    const char* cell_data = binary_data(lex,n_cells_size,sizeof(int32_t));
+    if (!cell_data) return nullptr;
+
+    if (lex.next() != "CELL_TYPES") return nullptr;
+    int64_t n_cells2;
+    if (!lex.next_integer(n_cells2) || n_cells != n_cells2) return nullptr;
+    const char* type_data = binary_data(lex,n_cells,sizeof(int32_t));
+    if (!type_data) return nullptr;
+
+    check_index_range(n_cells);
+    ElementList& elements = grid->elements;
+    elements.types.resize(n_cells);
+    elements.name_indices.assign(n_cells,0);
+    elements.offsets.resize(n_cells + 1);
+    elements.offsets[0] = 0;
+    std::vector <size_t> cell_starts (n_cells);
+    size_t cj = 0;
+    for (int64_t i = 0; i < n_cells; ++i) {
+      if (cj >= size_t(n_cells_size)) return nullptr;
+      int32_t n_elem_points = load_big_endian<int32_t>(cell_data + cj*sizeof(int32_t));
+      if (n_elem_points < 0) return nullptr;
+      Shape::Type type = type_from_vtk_id(load_big_endian<int32_t>(type_data + i*sizeof(int32_t)));
+      if (Shape::Info[type].n_points && Shape::Info[type].n_points != size_t(n_elem_points))
+        return nullptr;
+      elements.types[i] = type;
+      cell_starts[i] = cj + 1;
+      elements.offsets[i+1] = elements.offsets[i] + n_elem_points;
+      cj += n_elem_points + 1;
+    }
+    if (cj != size_t(n_cells_size)) return nullptr;
+
+    elements.connectivity.resize(elements.offsets.back());
+    std::atomic<bool> invalid (false);
+    parallel_for(n_cells,[&](size_t i) {
+      size_t n = elements.n_points(i);
+      for (size_t j = 0; j < n; ++j) {
+        int32_t p = load_big_endian<int32_t>(cell_data + (cell_starts[i] + j)*sizeof(int32_t));
+        if (p < 0 || p >= n_points)
+          invalid = true;
+        elements.connectivity[elements.offsets[i] + j] = p;
+      }
+    });
+    if (invalid) return nullptr;
+
+    return grid;
+  }
+
   Grid vtk_read(const std::string& filename) {
     std::cerr << "Reading " << filename << std::endl;
     std::ifstream f (filename);
@@ -196,7 +410,7 @@ namespace unstruc {
     if (type == "ASCII")
       grid = vtk_read_ascii(f);
     else if (type == "BINARY")
-      not_implemented("Currently don't support binary vtk files");
+      grid = vtk_read_binary(MappedFile(filename));
 
     if (!grid)
       fatal("Error reading VTK file : "+filename);
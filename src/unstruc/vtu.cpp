@@ -0,0 +1,280 @@
+#include "vtu.h"
+
+#include "grid.h"
+#include "element.h"
+#include "point.h"
+#include "error.h"
+#include "parallel.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+
+namespace unstruc {
+
+  static_assert(sizeof(Point) == 3*sizeof(double),"Points are written as packed doubles");
+  static_assert(sizeof(Vector) == 3*sizeof(double),"Vectors are written as packed doubles");
+
+  void VtuData::add_point_data(const std::string& name, const std::vector <double>& scalars) {
+    point_data.push_back(Array {name,1,scalars.size(),scalars.data()});
+  }
+
+  void VtuData::add_point_data(const std::string& name, const std::vector <Vector>& vectors) {
+    point_data.push_back(Array {name,3,vectors.size(),reinterpret_cast<const double*>(vectors.data())});
+  }
+
+  void VtuData::add_cell_data(const std::string& name, const std::vector <double>& scalars) {
+    cell_data.push_back(Array {name,1,scalars.size(),scalars.data()});
+  }
+
+  void VtuData::add_cell_data(const std::string& name, const std::vector <Vector>& vectors) {
+    cell_data.push_back(Array {name,3,vectors.size(),reinterpret_cast<const double*>(vectors.data())});
+  }
+
+  namespace {
+    const char* byte_order() {
+      const uint16_t one = 1;
+      unsigned char c;
+      memcpy(&c,&one,1);
+      return c == 1 ? "LittleEndian" : "BigEndian";
+    }
+
+    std::string xml_escape(const std::string& s) {
+      std::string escaped;
+      for (char c : s) {
+        switch (c) {
+        case '&': escaped += "&amp;"; break;
+        case '<': escaped += "&lt;"; break;
+        case '>': escaped += "&gt;"; break;
+        case '"': escaped += "&quot;"; break;
+        default: escaped += c;
+        }
+      }
+      return escaped;
+    }
+
+    // An array in the appended data block. Each is written as its size in
+    // bytes followed by the bytes themselves
+    struct AppendedArray {
+      std::string attributes;
+      const void* data;
+      uint64_t n_bytes;
+    };
+
+    std::string data_array_attributes(const char* type, const std::string& name, size_t n_components) {
+      std::ostringstream s;
+      s << "type=\"" << type << "\"";
+      if (!name.empty())
+        s << " Name=\"" << xml_escape(name) << "\"";
+      if (n_components != 1)
+        s << " NumberOfComponents=\"" << n_components << "\"";
+      return s.str();
+    }
+
+    const char* index_type() {
+      return sizeof(Index) == 8 ? "UInt64" : "UInt32";
+    }
+
+    AppendedArray data_array(const VtuData::Array& a, size_t n_tuples) {
+      if (a.n_tuples != n_tuples)
+        fatal("(unstruc::vtu_write) Data array '" + a.name + "' doesn't match the grid");
+      return AppendedArray {data_array_attributes("Float64",a.name,a.n_components),a.values,a.n_tuples*a.n_components*sizeof(double)};
+    }
+
+    void write_data_arrays(FILE* f, const char* tag, std::vector <AppendedArray>::const_iterator& a, size_t n, uint64_t& offset) {
+      if (n == 0) return;
+      fprintf(f,"      <%s>\n",tag);
+      for (size_t i = 0; i < n; ++i, ++a) {
+        fprintf(f,"        <DataArray %s format=\"appended\" offset=\"%llu\"/>\n",a->attributes.c_str(),(unsigned long long) offset);
+        offset += sizeof(uint64_t) + a->n_bytes;
+      }
+      fprintf(f,"      </%s>\n",tag);
+    }
+
+    // Grid of elements begin to end with only the points they use, numbered
+    // in order of first use. The points are found with a hash table, which
+    // is much quicker than sorting the connectivity of large pieces. points
+    // gets the grid point of each piece point
+    Grid element_range(const Grid& grid, size_t begin, size_t end, std::vector <Index>& points) {
+      const ElementList& elements = grid.elements;
+      size_t first = elements.offsets[begin];
+      size_t n_connectivity = elements.offsets[end] - first;
+
+      Grid piece (grid.dim);
+      piece.names = grid.names;
+      ElementList& piece_elements = piece.elements;
+      piece_elements.types.assign(elements.types.begin() + begin,elements.types.begin() + end);
+      piece_elements.name_indices.assign(elements.name_indices.begin() + begin,elements.name_indices.begin() + end);
+      piece_elements.offsets.resize(end - begin + 1);
+      for (size_t i = begin; i <= end; ++i)
+        piece_elements.offsets[i - begin] = elements.offsets[i] - first;
+      piece_elements.connectivity.resize(n_connectivity);
+
+      size_t table_size = 1;
+      while (table_size < 2*n_connectivity)
+        table_size *= 2;
+      std::vector <Index> keys (table_size,max_index);
+      std::vector <Index> values (table_size);
+      points.clear();
+      for (size_t j = 0; j < n_connectivity; ++j) {
+        Index p = elements.connectivity[first + j];
+        size_t slot = (uint64_t(p)*0x9e3779b97f4a7c15ULL >> 20) & (table_size - 1);
+        while (keys[slot] != max_index && keys[slot] != p)
+          slot = (slot + 1) & (table_size - 1);
+        if (keys[slot] == max_index) {
+          keys[slot] = p;
+          values[slot] = points.size();
+          points.push_back(p);
+        }
+        piece_elements.connectivity[j] = values[slot];
+      }
+
+      piece.points.resize(points.size());
+      for (size_t j = 0; j < points.size(); ++j)
+        piece.points[j] = grid.points[points[j]];
+      return piece;
+    }
+
+    // Values of the used points of a piece, in the order element_range numbers them
+    std::vector <double> gather(const VtuData::Array& a, const std::vector <Index>& points) {
+      std::vector <double> values (points.size()*a.n_components);
+      for (size_t i = 0; i < points.size(); ++i) {
+        for (size_t j = 0; j < a.n_components; ++j)
+          values[i*a.n_components + j] = a.values[points[i]*a.n_components + j];
+      }
+      return values;
+    }
+  }
+
+  void vtu_write(const std::string& filename, const Grid& grid, const VtuData& data) {
+    FILE* f = fopen(filename.c_str(),"wb");
+    fprintf(stderr,"Writing %s\n",filename.c_str());
+    if (!f) fatal("Could not open file");
+
+    const ElementList& elements = grid.elements;
+    size_t n_points = grid.points.size();
+    size_t n_elements = elements.size();
+
+    // Points are written straight from the grid unless z has to be zeroed
+    std::vector <Point> flat_points;
+    const Point* points = grid.points.data();
+    if (grid.dim != 3) {
+      flat_points = grid.points;
+      for (Point& p : flat_points)
+        p.z = 0;
+      points = flat_points.data();
+    }
+    std::vector <uint8_t> types (n_elements);
+    parallel_for(n_elements,[&](size_t i) { types[i] = Shape::Info[elements.types[i]].vtk_id; });
+
+    std::vector <AppendedArray> arrays;
+    for (const VtuData::Array& a : data.point_data)
+      arrays.push_back(data_array(a,n_points));
+    for (const VtuData::Array& a : data.cell_data)
+      arrays.push_back(data_array(a,n_elements));
+    arrays.push_back(AppendedArray {data_array_attributes("Float64","",3),points,n_points*sizeof(Point)});
+    arrays.push_back(AppendedArray {data_array_attributes(index_type(),"connectivity",1),elements.connectivity.data(),elements.connectivity.size()*sizeof(Index)});
+    arrays.push_back(AppendedArray {data_array_attributes("UInt64","offsets",1),elements.offsets.data() + 1,n_elements*sizeof(uint64_t)});
+    arrays.push_back(AppendedArray {data_array_attributes("UInt8","types",1),types.data(),n_elements*sizeof(uint8_t)});
+    static_assert(sizeof(elements.offsets[0]) == sizeof(uint64_t),"Offsets are written as UInt64");
+
+    fprintf(f,"<?xml version=\"1.0\"?>\n");
+    fprintf(f,"<VTKFile type=\"UnstructuredGrid\" version=\"1.0\" byte_order=\"%s\" header_type=\"UInt64\">\n",byte_order());
+    fprintf(f,"  <UnstructuredGrid>\n");
+    fprintf(f,"    <Piece NumberOfPoints=\"%lu\" NumberOfCells=\"%lu\">\n",n_points,n_elements);
+    uint64_t offset = 0;
+    std::vector <AppendedArray>::const_iterator a = arrays.begin();
+    write_data_arrays(f,"PointData",a,data.point_data.size(),offset);
+    write_data_arrays(f,"CellData",a,data.cell_data.size(),offset);
+    write_data_arrays(f,"Points",a,1,offset);
+    write_data_arrays(f,"Cells",a,3,offset);
+    fprintf(f,"    </Piece>\n");
+    fprintf(f,"  </UnstructuredGrid>\n");
+    fprintf(f,"  <AppendedData encoding=\"raw\">\n_");
+    for (const AppendedArray& a : arrays) {
+      fwrite(&a.n_bytes,sizeof(a.n_bytes),1,f);
+      if (a.n_bytes > 0 && fwrite(a.data,1,a.n_bytes,f) != a.n_bytes)
+        fatal("Could not write file");
+    }
+    fprintf(f,"\n  </AppendedData>\n");
+    fprintf(f,"</VTKFile>\n");
+    fclose(f);
+  }
+
+  void pvtu_write(const std::string& filename, const Grid& grid, size_t n_pieces, const VtuData& data) {
+    size_t n_elements = grid.elements.size();
+    n_pieces = std::max(size_t(1),std::min(n_pieces,n_elements));
+
+    std::string stem = filename;
+    if (stem.size() > 5 && stem.compare(stem.size()-5,5,".pvtu") == 0)
+      stem.resize(stem.size()-5);
+    std::vector <std::string> piece_filenames (n_pieces);
+    for (size_t i = 0; i < n_pieces; ++i) {
+      std::ostringstream s;
+      s << stem << "_" << i << ".vtu";
+      piece_filenames[i] = s.str();
+    }
+
+    for (const VtuData::Array& a : data.point_data) {
+      if (a.n_tuples != grid.points.size())
+        fatal("(unstruc::pvtu_write) Data array '" + a.name + "' doesn't match the grid");
+    }
+    for (const VtuData::Array& a : data.cell_data) {
+      if (a.n_tuples != n_elements)
+        fatal("(unstruc::pvtu_write) Data array '" + a.name + "' doesn't match the grid");
+    }
+
+    parallel_for(n_pieces,[&](size_t i) {
+      size_t begin = i*n_elements/n_pieces;
+      size_t end = (i+1)*n_elements/n_pieces;
+      std::vector <Index> points;
+      Grid piece = element_range(grid,begin,end,points);
+
+      // Point data follows the points of the piece, cell data is a range
+      std::vector< std::vector <double> > values;
+      values.reserve(data.point_data.size());
+      VtuData piece_data;
+      for (const VtuData::Array& a : data.point_data) {
+        values.push_back(gather(a,points));
+        piece_data.point_data.push_back(VtuData::Array {a.name,a.n_components,points.size(),values.back().data()});
+      }
+      for (const VtuData::Array& a : data.cell_data)
+        piece_data.cell_data.push_back(VtuData::Array {a.name,a.n_components,end - begin,a.values + begin*a.n_components});
+      vtu_write(piece_filenames[i],piece,piece_data);
+    },1);
+
+    FILE* f = fopen(filename.c_str(),"w");
+    fprintf(stderr,"Writing %s\n",filename.c_str());
+    if (!f) fatal("Could not open file");
+    fprintf(f,"<?xml version=\"1.0\"?>\n");
+    fprintf(f,"<VTKFile type=\"PUnstructuredGrid\" version=\"1.0\" byte_order=\"%s\" header_type=\"UInt64\">\n",byte_order());
+    fprintf(f,"  <PUnstructuredGrid GhostLevel=\"0\">\n");
+    if (!data.point_data.empty()) {
+      fprintf(f,"    <PPointData>\n");
+      for (const VtuData::Array& a : data.point_data)
+        fprintf(f,"      <PDataArray %s/>\n",data_array_attributes("Float64",a.name,a.n_components).c_str());
+      fprintf(f,"    </PPointData>\n");
+    }
+    if (!data.cell_data.empty()) {
+      fprintf(f,"    <PCellData>\n");
+      for (const VtuData::Array& a : data.cell_data)
+        fprintf(f,"      <PDataArray %s/>\n",data_array_attributes("Float64",a.name,a.n_components).c_str());
+      fprintf(f,"    </PCellData>\n");
+    }
+    fprintf(f,"    <PPoints>\n");
+    fprintf(f,"      <PDataArray %s/>\n",data_array_attributes("Float64","",3).c_str());
+    fprintf(f,"    </PPoints>\n");
+    // Pieces are referenced relative to the .pvtu file
+    for (const std::string& piece_filename : piece_filenames) {
+      size_t slash = piece_filename.find_last_of("/\\");
+      std::string source = slash == std::string::npos ? piece_filename : piece_filename.substr(slash+1);
+      fprintf(f,"    <Piece Source=\"%s\"/>\n",xml_escape(source).c_str());
+    }
+    fprintf(f,"  </PUnstructuredGrid>\n");
+    fprintf(f,"</VTKFile>\n");
+    fclose(f);
+  }
+
+} //namespace unstruc